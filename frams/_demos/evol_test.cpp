@@ -5,9 +5,16 @@
 
 #include <vector>
 #include <numeric> //std::accumulate()
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "common/loggers/loggertostdout.h"
 #include "frams/genetics/preconfigured.h"
 #include "frams/genetics/genman.h"
+#include "frams/genetics/fS/fS_conv.h"
+#include "frams/genetics/fS/fS_archive.h"
 #include "frams/model/model.h"
 #include "frams/model/geometry/modelgeometryinfo.h"
 
@@ -16,104 +23,201 @@ struct Individual
 {
 	Geno geno;
 	double fitness;
+	vector<double> criteria; //the values of FitnessPlan::criteria, kept for printing population stats
+	int64_t archive_index = -1; //the index of the record in the archive of evaluated individuals, if there is one
 };
 
-double criterion(char symbol, double value)
+//fitness_def compiled once, so that every individual is evaluated in a single pass
+struct FitnessPlan
 {
-	return isupper(symbol) ? value : -value;
+	string criteria; //distinct criteria (upper case symbols) measured for every individual, in the order of Individual::criteria
+	vector<std::pair<int, double>> terms; //the index in criteria and the weight (+1 or -1) of each term of fitness
+	bool needs_sizes = false; //H, W and D share one ModelGeometryInfo::findSizesAndAxes() call
+
+	int index_of(char symbol) const
+	{
+		return int(criteria.find(toupper(symbol)));
+	}
+
+	int add_criterion(char symbol)
+	{
+		if (strchr("LPJNCBSVHWD", toupper(symbol)) == NULL)
+		{
+			printf("Unknown fitness criterion symbol: '%c'\n", symbol);
+			exit(3);
+		}
+		if (index_of(symbol) < 0)
+			criteria += char(toupper(symbol));
+		if (strchr("HWD", toupper(symbol)) != NULL)
+			needs_sizes = true;
+		return index_of(symbol);
+	}
+};
+
+//Compile the fitness definition; stats_criteria are the criteria that are also measured for printing population stats
+FitnessPlan compile_fitness(const char *fitness_def, const char *stats_criteria)
+{
+	FitnessPlan plan;
+	for (const char *p = fitness_def; *p; p++)
+		if (*p != '0')
+			plan.terms.push_back(std::make_pair(plan.add_criterion(*p), isupper(*p) ? 1.0 : -1.0));
+	for (const char *p = stats_criteria; *p; p++)
+		plan.add_criterion(*p);
+	return plan;
 }
 
-double get_fitness(const Individual &ind, const char *fitness_def)
+std::mutex conversion_mutex; //genotypes of formats other than fS are converted by the shared converters, one at a time
+
+void update_fitness(Individual &ind, const FitnessPlan &plan)
 {
 	SString genotype = ind.geno.getGenes();
-	Model model = Model(ind.geno, Model::SHAPETYPE_UNKNOWN);
-	double fitness = 0;
-	const char *p = fitness_def;
+	Model model;
+	if (ind.geno.getFormat() == "S") //fS genotypes are built directly, without converting them to f0 text and parsing it back
+		GenoConv_fS0s::buildModel(genotype, model);
+	else
+	{
+		std::lock_guard<std::mutex> lock(conversion_mutex);
+		model = Model(ind.geno, Model::SHAPETYPE_UNKNOWN);
+	}
 
 	Orient axes;
 	Pt3D sizes;
-	while (*p)
+	if (plan.needs_sizes)
+		ModelGeometryInfo::findSizesAndAxes(model, 1.0, sizes, axes);
+	ind.criteria.resize(plan.criteria.size());
+	for (size_t i = 0; i < plan.criteria.size(); i++)
 	{
-		switch (*p)
+		double &value = ind.criteria[i];
+		switch (plan.criteria[i])
 		{
-			case '0':
-				break;
-			case '!': //special symbol for current fitness (used only in printing population stats)
-				fitness += ind.fitness;
-				break;
-			case 'l':
-			case 'L':
-				fitness += criterion(*p, genotype.length());
-				break;
-			case 'p':
-			case 'P':
-				fitness += criterion(*p, model.getPartCount());
-				break;
-			case 'j':
-			case 'J':
-				fitness += criterion(*p, model.getJointCount());
-				break;
-			case 'n':
-			case 'N':
-				fitness += criterion(*p, model.getNeuroCount());
-				break;
-			case 'c':
-			case 'C':
-				fitness += criterion(*p, model.getConnectionCount());
-				break;
-			case 'b':
-			case 'B':
-				fitness += criterion(*p, model.size.x * model.size.y * model.size.z);
-				break;
-			case 's':
-			case 'S':
-				fitness += criterion(*p, ModelGeometryInfo::area(model, 1.0));
-				break;
-			case 'v':
-			case 'V':
-				fitness += criterion(*p, ModelGeometryInfo::volume(model, 1.0));
-				break;
-			case 'h':
-			case 'H':
-				ModelGeometryInfo::findSizesAndAxes(model, 1.0, sizes, axes);
-				fitness += criterion(*p, sizes.x);
-				break;
-			case 'w':
-			case 'W':
-				ModelGeometryInfo::findSizesAndAxes(model, 1.0, sizes, axes);
-				fitness += criterion(*p, sizes.y);
-				break;
-			case 'd':
-			case 'D':
-				ModelGeometryInfo::findSizesAndAxes(model, 1.0, sizes, axes);
-				fitness += criterion(*p, sizes.z);
-				break;
-			default:
-				printf("Unknown fitness criterion symbol: '%c'\n", *p);
-				exit(3);
+			case 'L': value = genotype.length(); break;
+			case 'P': value = model.getPartCount(); break;
+			case 'J': value = model.getJointCount(); break;
+			case 'N': value = model.getNeuroCount(); break;
+			case 'C': value = model.getConnectionCount(); break;
+			case 'B': value = model.size.x * model.size.y * model.size.z; break;
+			case 'S': value = ModelGeometryInfo::area(model, 1.0); break;
+			case 'V': value = ModelGeometryInfo::volume(model, 1.0); break;
+			case 'H': value = sizes.x; break;
+			case 'W': value = sizes.y; break;
+			case 'D': value = sizes.z; break;
 		}
-		p++;
 	}
-	return fitness;
+
+	ind.fitness = 0;
+	for (const std::pair<int, double> &term : plan.terms)
+		ind.fitness += term.second * ind.criteria[term.first];
 }
 
-void update_fitness(Individual &ind, const char *fitness_def)
+//A fixed set of threads that evaluate batches of individuals. The calling thread evaluates individuals too.
+class EvaluationPool
+{
+	vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work_ready, work_done;
+	const vector<Individual*> *batch = NULL;
+	const FitnessPlan *plan = NULL;
+	std::atomic<int> next_index{0};
+	int batch_number = 0; //incremented for every batch, so that the threads notice new work
+	int busy_threads = 0;
+	bool stopping = false;
+
+	void evaluate_batch()
+	{
+		for (int i = next_index++; i < int(batch->size()); i = next_index++)
+			update_fitness(*(*batch)[i], *plan);
+	}
+
+	void worker()
+	{
+		int last_batch = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			work_ready.wait(lock, [&] { return stopping || batch_number != last_batch; });
+			if (stopping)
+				return;
+			last_batch = batch_number;
+			lock.unlock();
+			evaluate_batch();
+			lock.lock();
+			if (--busy_threads == 0)
+				work_done.notify_one();
+		}
+	}
+
+public:
+	EvaluationPool(int thread_count)
+	{
+		for (int i = 1; i < thread_count; i++)
+			threads.push_back(std::thread(&EvaluationPool::worker, this));
+	}
+
+	~EvaluationPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_ready.notify_all();
+		for (std::thread &thread : threads)
+			thread.join();
+	}
+
+	//Evaluate all the individuals and return when they are done
+	void evaluate(const vector<Individual*> &individuals, const FitnessPlan &_plan)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			batch = &individuals;
+			plan = &_plan;
+			next_index = 0;
+			busy_threads = threads.size();
+			batch_number++;
+		}
+		work_ready.notify_all();
+		evaluate_batch();
+		std::unique_lock<std::mutex> lock(mutex);
+		work_done.wait(lock, [&] { return busy_threads == 0; });
+	}
+};
+
+//Add the evaluated individual to the archive. fS genotypes are stored in the binary form, others as text.
+void archive_individual(fS_ArchiveWriter *archive, Individual &ind, int64_t parent1, int64_t parent2)
 {
-	ind.fitness = get_fitness(ind, fitness_def);
+	if (archive == NULL)
+		return;
+	if (ind.geno.getFormat() == "S")
+	{
+		try
+		{
+			fS_Genotype genotype(ind.geno.getGenes().c_str());
+			ind.archive_index = archive->add(genotype, ind.fitness, parent1, parent2);
+			return;
+		}
+		catch (fS_Exception &e) //an invalid genotype is kept as it is
+		{
+		}
+	}
+	ind.archive_index = archive->add(ind.geno.getGenes(), ind.geno.getFormat(), ind.fitness, parent1, parent2);
 }
 
-void print_stats(const vector<Individual> &population, char criterion)
+//Print stats of the criterion with the given index in FitnessPlan::criteria, or of fitness if the index is negative
+void print_stats(const vector<Individual> &population, int criterion)
 {
 	vector<double> criterion_values;
-	char crit[2] = { 0 };
-	crit[0] = criterion;
 	for (const Individual& ind : population)
-		criterion_values.push_back(get_fitness(ind, crit));
+		criterion_values.push_back(criterion < 0 ? ind.fitness : ind.criteria[criterion]);
 	printf("%g,%g,%g", *std::min_element(criterion_values.begin(), criterion_values.end()),
 		   std::accumulate(criterion_values.begin(), criterion_values.end(), 0.0) / criterion_values.size(),
 		   *std::max_element(criterion_values.begin(), criterion_values.end()));
 }
 
+double elapsed_seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 int tournament(const vector<Individual> &population, int tournament_size)
 {
 	int best = -1;
@@ -144,7 +248,7 @@ int main(int argc, char *argv[])
 	if (argc < 8)
 	{
 		printf("Too few parameters!\n");
-		printf("Command line: <deterministic?_0_or_1> <population_size> <nr_evaluations> <prob_mut> <prob_xover> <genetic_format> <fitness_definition>\n");
+		printf("Command line: <deterministic?_0_or_1> <population_size> <nr_evaluations> <prob_mut> <prob_xover> <genetic_format> <fitness_definition> [archive_file|-] [threads] [batch_size]\n");
 		printf("Example: 1 10 50 0.6 0.4 4 NC\n\n");
 		printf("Fitness definition is a sequence of capital (+1 weight) and small (-1 weight) letters.\n");
 		printf("Each letter corresponds to one fitness criterion, and they are all weighted and added together.\n");
@@ -165,6 +269,12 @@ int main(int argc, char *argv[])
 		printf("The first column is the number of mutated or crossed over and evaluated genotypes.\n");
 		printf("The remaining columns are triplets of min,avg,max (in the population) of fitness, Parts, Joints, Neurons, Connections, genotype characters.\n");
 		printf("Finally, the genotypes in the last population are printed with their fitness values.\n");
+		printf("\nIf archive_file is given, every evaluated genotype is stored there with its fitness and the archive indices of its parents\n");
+		printf("(see fS_archive.h). The archive index is created next to it, with the .idx extension. Use - for no archive.\n");
+		printf("\nOffspring are created and evaluated in batches of batch_size (1 by default), using the given number of threads\n");
+		printf("(1 by default) to evaluate each batch. All the offspring of a batch are created from the population before the batch,\n");
+		printf("and then they replace the selected individuals in the order of creation, so the output does not depend on the number of threads.\n");
+		printf("The time of variation, evaluation and statistics is printed on standard error at the end.\n");
 		return 1;
 	}
 
@@ -176,10 +286,29 @@ int main(int argc, char *argv[])
 	format = argv[6];
 	fitness_def = argv[7];
 
+	int thread_count = argc > 9 ? max(1, atoi(argv[9])) : 1;
+	int batch_size = argc > 10 ? max(1, atoi(argv[10])) : 1;
+	const char *STATS_CRITERIA = "PJNCL";
+	FitnessPlan plan = compile_fitness(fitness_def, STATS_CRITERIA);
+
+	fS_ArchiveWriter archive_writer;
+	fS_ArchiveWriter *archive = NULL;
+	if (argc > 8 && strcmp(argv[8], "-") != 0)
+	{
+		if (!archive_writer.open(argv[8]))
+		{
+			printf("Could not create the archive '%s'\n", argv[8]);
+			return 4;
+		}
+		archive = &archive_writer;
+	}
+
 	if (!deterministic)
 		rndGetInstance().randomize();
 
+	double variation_time = 0, evaluation_time = 0, stats_time = 0;
 	vector<Individual> population(pop_size);
+	vector<Individual*> batch;
 	for (Individual& ind : population)
 	{
 		ind.geno = genman.getSimplest(format);
@@ -188,51 +317,86 @@ int main(int argc, char *argv[])
 			printf("Could not get the simplest genotype for format '%s'\n", format);
 			return 2;
 		}
-		update_fitness(ind, fitness_def);
+		batch.push_back(&ind);
 	}
-	for (int i = 0; i < nr_evals; i++)
-	{
-		int selected_positive = tournament(population, max(2, int(sqrt(population.size()) / 2))); //moderate positive selection pressure
-		int selected_negative = rndUint(population.size()); //random negative selection
+	// The threads are started when all the arguments are known to be valid, as invalid ones end the program
+	EvaluationPool evaluation_pool(thread_count);
+	auto start = std::chrono::steady_clock::now();
+	evaluation_pool.evaluate(batch, plan);
+	evaluation_time += elapsed_seconds(start);
+	for (Individual& ind : population)
+		archive_individual(archive, ind, -1, -1);
 
-		double rnd = rndDouble(prob_mut + prob_xover);
-		if (rnd < prob_mut)
+	struct Offspring
+	{
+		Individual individual;
+		bool created; //false if the genetic operator failed
+		int selected_negative; //the individual that the offspring replaces
+		int64_t parents[2]; //the archive indices of the parents
+	};
+	vector<Offspring> offspring;
+	for (int batch_start = 0; batch_start < nr_evals; batch_start += batch_size)
+	{
+		int batch_end = min(nr_evals, batch_start + batch_size);
+		start = std::chrono::steady_clock::now();
+		offspring.assign(batch_end - batch_start, Offspring());
+		for (Offspring &child : offspring)
 		{
-			Geno mutant = genman.mutate(population[selected_positive].geno);
-			if (mutant.getGenes() == "")
+			int selected_positive = tournament(population, max(2, int(sqrt(population.size()) / 2))); //moderate positive selection pressure
+			child.selected_negative = rndUint(population.size()); //random negative selection
+			child.parents[0] = population[selected_positive].archive_index;
+			child.parents[1] = -1;
+
+			double rnd = rndDouble(prob_mut + prob_xover);
+			if (rnd < prob_mut)
 			{
-				printf("Failed mutation (%s) of '%s'\n", mutant.getComment().c_str(), population[selected_positive].geno.getGenes().c_str());
+				child.individual.geno = genman.mutate(population[selected_positive].geno);
+				if (child.individual.geno.getGenes() == "")
+					printf("Failed mutation (%s) of '%s'\n", child.individual.geno.getComment().c_str(), population[selected_positive].geno.getGenes().c_str());
 			}
 			else
 			{
-				population[selected_negative].geno = mutant;
-				update_fitness(population[selected_negative], fitness_def);
+				int selected_positive2 = tournament(population, max(2, int(sqrt(population.size()) / 2)));
+				child.parents[1] = population[selected_positive2].archive_index;
+				child.individual.geno = genman.crossOver(population[selected_positive].geno, population[selected_positive2].geno);
+				if (child.individual.geno.getGenes() == "")
+					printf("Failed crossover (%s) of '%s' and '%s'\n", child.individual.geno.getComment().c_str(), population[selected_positive].geno.getGenes().c_str(), population[selected_positive2].geno.getGenes().c_str());
 			}
+			child.created = child.individual.geno.getGenes() != "";
 		}
-		else
+		variation_time += elapsed_seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		batch.clear();
+		for (Offspring &child : offspring)
+			if (child.created)
+				batch.push_back(&child.individual);
+		evaluation_pool.evaluate(batch, plan);
+		evaluation_time += elapsed_seconds(start);
+
+		for (int i = batch_start; i < batch_end; i++)
 		{
-			int selected_positive2 = tournament(population, max(2, int(sqrt(population.size()) / 2)));
-			Geno xover = genman.crossOver(population[selected_positive].geno, population[selected_positive2].geno);
-			if (xover.getGenes() == "")
-			{
-				printf("Failed crossover (%s) of '%s' and '%s'\n", xover.getComment().c_str(), population[selected_positive].geno.getGenes().c_str(), population[selected_positive2].geno.getGenes().c_str());
-			}
-			else
+			Offspring &child = offspring[i - batch_start];
+			if (child.created)
 			{
-				population[selected_negative].geno = xover;
-				update_fitness(population[selected_negative], fitness_def);
+				population[child.selected_negative] = child.individual;
+				archive_individual(archive, population[child.selected_negative], child.parents[0], child.parents[1]);
 			}
-		}
 
-		if (i % population.size() == 0 || i == nr_evals - 1)
-		{
-			printf("Evaluation %d", i);
-			for (char c : string("!PJNCL"))
+			if (i % population.size() == 0 || i == nr_evals - 1)
 			{
+				start = std::chrono::steady_clock::now();
+				printf("Evaluation %d", i);
 				printf("\t");
-				print_stats(population, c);
+				print_stats(population, -1);
+				for (const char *c = STATS_CRITERIA; *c; c++)
+				{
+					printf("\t");
+					print_stats(population, plan.index_of(*c));
+				}
+				printf("\n");
+				stats_time += elapsed_seconds(start);
 			}
-			printf("\n");
 		}
 	}
 	for (const Individual& ind : population)
@@ -240,6 +404,8 @@ int main(int argc, char *argv[])
 		printf("%.1f\t", ind.fitness);
 		printf("%s\n", ind.geno.getGenesAndFormat().c_str());
 	}
+	fprintf(stderr, "Time of variation: %.3f s, evaluation: %.3f s (%d threads, batches of %d), statistics: %.3f s\n",
+		variation_time, evaluation_time, thread_count, batch_size, stats_time);
 
 	return 0;
 }
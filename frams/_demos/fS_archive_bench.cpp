@@ -0,0 +1,152 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <filesystem>
+#include <vector>
+#include <common/nonstd_math.h>
+#include "frams/genetics/fS/fS_general.h"
+#include "frams/genetics/fS/fS_oper.h"
+#include "frams/genetics/fS/fS_archive.h"
+#include "frams/genetics/preconfigured.h"
+
+/*
+ * Measures writing and reading an archive of evaluated individuals (see fS_archive.h).
+ * Writes an archive of the given number of fS individuals with lineage, then reads it back:
+ * scans the fitness of all the records, scans and decodes all the genotypes,
+ * and reads and decodes the genotypes of randomly chosen records.
+ * The archive is removed at the end, unless it is kept with the last argument.
+ *
+ * Usage: fS_archive_bench [archive_file] [record_count] [random_reads] [keep_0_or_1]
+ */
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+const char *SEEDS[] = {
+		"1.1:EcE[N'1]cRbC[G'0]bC[N'0'1]{x=1.02;y=1.02;z=1.03}",
+		"1.1:RcR[N'0]bR[N'0'1]",
+		"1.1:E(cE(bE[T;T'1'2]^cE^bC[N'0]^cR)^bE[N'0'2;N'0'2]^cE(bcE^bcE[N;N'0'1'2])^E)",
+		"1.1:E[Sin'2:2.0;T'0:3.0;T'0:4.0'1:5.0]",
+};
+const int SEED_COUNT = sizeof(SEEDS) / sizeof(SEEDS[0]);
+const int DISTINCT_GENOTYPES = 2000;	/// Mutating is much slower than archiving, so the records reuse a pool of genotypes
+
+void printRate(const char *name, double nanoseconds, int64_t count)
+{
+	cout.precision(1);
+	cout << name << ": " << std::fixed << nanoseconds / 1e6 << " ms (" << (nanoseconds > 0 ? count / (nanoseconds / 1e9) : 0)
+		 << " records/s, " << (count > 0 ? nanoseconds / count : 0) << " ns/record)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	PreconfiguredGenetics genetics;
+
+	const char *path = argc > 1 ? argv[1] : "fS_archive_bench.tmp";
+	int64_t recordCount = argc > 2 ? atoll(argv[2]) : 1000000;
+	int64_t randomReads = argc > 3 ? atoll(argv[3]) : 100000;
+	bool keep = argc > 4 && atoi(argv[4]) == 1;
+	if (recordCount <= 0 || randomReads < 0)
+	{
+		cerr << "Invalid number of records" << endl;
+		return 1;
+	}
+
+	GenoOper_fS operators;
+	vector<fS_Genotype *> pool;
+	vector<string> lineage(SEEDS, SEEDS + SEED_COUNT);
+	while (int(pool.size()) < DISTINCT_GENOTYPES)
+	{
+		char *genotype = strdup(lineage[lineage.size() - 1 - rndUint(std::min(int(lineage.size()), 100))].c_str());
+		float chg;
+		int method;
+		if (operators.mutate(genotype, chg, method) == GENOPER_OK && operators.checkValidity(genotype, "") == 0)
+		{
+			lineage.push_back(genotype);
+			pool.push_back(new fS_Genotype(genotype));
+		}
+		free(genotype);
+	}
+
+	fS_ArchiveWriter writer;
+	if (!writer.open(path))
+	{
+		cerr << "Can not create " << path << endl;
+		return 1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < recordCount; i++)
+	{
+		fS_Genotype *genotype = pool[i % DISTINCT_GENOTYPES];
+		// Like in a steady-state run, the parent is one of the recently evaluated individuals
+		int64_t parent = i > 0 ? i - 1 - rndUint(unsigned(std::min(i, int64_t(1000)))) : -1;
+		writer.add(*genotype, genotype->getNodeCount(), parent, -1);
+	}
+	writer.close();
+	double writeTime = fS_elapsedNanoseconds(start);
+
+	fS_ArchiveReader reader;
+	if (!reader.open(path))
+	{
+		cerr << "Can not open " << path << endl;
+		return 1;
+	}
+	double checksum = 0;
+	start = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < reader.getRecordCount(); i++)
+		checksum += reader.getFitness(i);
+	double fitnessScanTime = fS_elapsedNanoseconds(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < reader.getRecordCount(); i++)
+	{
+		fS_Genotype *genotype = reader.getGenotype(reader.get(i));
+		checksum -= genotype->getNodeCount();
+		delete genotype;
+	}
+	double genotypeScanTime = fS_elapsedNanoseconds(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < randomReads; i++)
+	{
+		fS_ArchiveEntry entry = reader.get(rndUint(unsigned(std::min(reader.getRecordCount(), int64_t(UINT_MAX)))));
+		fS_Genotype *genotype = reader.getGenotype(entry);
+		checksum += genotype->getNodeCount() - entry.fitness;
+		delete genotype;
+	}
+	double randomReadTime = fS_elapsedNanoseconds(start);
+
+	// Follow random records up to ten generations back through the parent indices
+	int64_t ancestorSteps = 0;
+	start = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < randomReads; i++)
+	{
+		int64_t index = rndUint(unsigned(std::min(reader.getRecordCount(), int64_t(UINT_MAX))));
+		for (int step = 0; step < 10 && index >= 0; step++, ancestorSteps++)
+			index = reader.get(index).parents[0];
+	}
+	double lineageTime = fS_elapsedNanoseconds(start);
+
+	cout << "records: " << reader.getRecordCount() << endl;
+	std::error_code error;
+	cout << "archive size: " << std::filesystem::file_size(path, error) << " bytes + index "
+		 << std::filesystem::file_size(string(path) + ARCHIVE_INDEX_SUFFIX, error) << " bytes" << endl;
+	printRate("write", writeTime, recordCount);
+	printRate("sequential fitness scan", fitnessScanTime, reader.getRecordCount());
+	printRate("sequential genotype scan", genotypeScanTime, reader.getRecordCount());
+	printRate("random genotype reads", randomReadTime, randomReads);
+	printRate("random lineage steps", lineageTime, ancestorSteps);
+	cout << "checksum: " << checksum << endl;
+
+	reader.close();
+	for (int i = 0; i < int(pool.size()); i++)
+		delete pool[i];
+	if (!keep)
+	{
+		remove(path);
+		remove((string(path) + ARCHIVE_INDEX_SUFFIX).c_str());
+	}
+	return 0;
+}
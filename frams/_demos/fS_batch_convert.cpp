@@ -0,0 +1,164 @@
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "frams/genetics/fS/fS_general.h"
+#include "frams/genetics/fS/fS_conv.h"
+#include "frams/genetics/fS/fS_oper.h"
+#include "frams/genetics/preconfigured.h"
+
+/*
+ * Converts fS genotypes to f0 using many threads.
+ * Reads one genotype per line from a file or from standard input and writes the f0 genotypes to standard output
+ * in the input order, each followed by an empty line. The genotypes that can not be converted leave an empty record
+ * and are reported on standard error with their line number and error position.
+ * The input is processed in chunks, so memory use does not grow with the number of genotypes.
+ * The throughput and the time of the conversion stages are printed on standard error at the end.
+ *
+ * Usage: fS_batch_convert [input_file|-] [thread_count] [chunk_size]
+ */
+
+using std::cerr;
+using std::endl;
+
+struct ConvertedGenotype
+{
+	string genotype;
+	SString f0;
+	bool valid;
+};
+
+/**
+ * Convert all the genotypes of a chunk, each thread taking the next unconverted genotype
+ * @param nextIndex the index of the next genotype to convert, shared between threads
+ */
+void worker(vector<ConvertedGenotype> &chunk, std::atomic<int> &nextIndex, fS_ConversionTimes &times)
+{
+	GenoConv_fS0s converter;
+	converter.conversionTimes = &times;
+	for (int i = nextIndex++; i < int(chunk.size()); i = nextIndex++)
+	{
+		SString genotype(chunk[i].genotype.c_str());
+		chunk[i].f0 = converter.convert(genotype, nullptr, false);
+		chunk[i].valid = chunk[i].f0.length() > 0;
+	}
+}
+
+/// Print the reason why a genotype could not be converted
+void reportError(const string &genotype, int lineNumber)
+{
+	try
+	{
+		fS_Genotype parsed(genotype);
+		cerr << "line " << lineNumber << ": conversion failed" << endl;
+	}
+	catch (fS_Exception &e)
+	{
+		cerr << "line " << lineNumber << ", position " << e.errorPosition + 1 << ": " << e.what() << endl;
+	}
+}
+
+void printStage(const char *name, double nanoseconds, double total)
+{
+	cerr.precision(3);
+	cerr << "  " << name << ": " << std::fixed << nanoseconds / 1e6 << " ms (" << (total > 0 ? 100 * nanoseconds / total : 0) << "%)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	PreconfiguredGenetics genetics;
+
+	const char *inputName = argc > 1 ? argv[1] : "-";
+	int threadCount = argc > 2 ? atoi(argv[2]) : 0;
+	int chunkSize = argc > 3 ? atoi(argv[3]) : 4096;
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	if (chunkSize <= 0)
+		chunkSize = 4096;
+
+	std::ifstream file;
+	std::istream *input = &std::cin;
+	if (strcmp(inputName, "-") != 0)
+	{
+		file.open(inputName);
+		if (!file)
+		{
+			cerr << "Can not open " << inputName << endl;
+			return 1;
+		}
+		input = &file;
+	}
+
+	vector<fS_ConversionTimes> threadTimes(threadCount);
+	fS_ThreadPool threadPool;	// The threads are started for the first chunk and kept for the next ones
+	vector<ConvertedGenotype> chunk;
+	chunk.reserve(chunkSize);
+	int lineNumber = 0, converted = 0, failed = 0;
+	auto start = std::chrono::steady_clock::now();
+	string line;
+	bool endOfInput = false;
+	while (!endOfInput)
+	{
+		chunk.clear();
+		vector<int> lineNumbers;
+		while (int(chunk.size()) < chunkSize)
+		{
+			if (!std::getline(*input, line))
+			{
+				endOfInput = true;
+				break;
+			}
+			lineNumber++;
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (line.empty())
+				continue;
+			chunk.push_back({line, SString(), false});
+			lineNumbers.push_back(lineNumber);
+		}
+		if (chunk.empty())
+			break;
+
+		std::atomic<int> nextIndex(0);
+		threadPool.run(threadCount, [&](int index) { worker(chunk, nextIndex, threadTimes[index]); });
+
+		for (int i = 0; i < int(chunk.size()); i++)
+		{
+			if (chunk[i].valid)
+			{
+				fwrite(chunk[i].f0.c_str(), 1, chunk[i].f0.length(), stdout);
+				converted++;
+			}
+			else
+			{
+				reportError(chunk[i].genotype, lineNumbers[i]);
+				failed++;
+			}
+			fputc('\n', stdout);
+		}
+		fflush(stdout);
+	}
+	double seconds = fS_elapsedNanoseconds(start) / 1e9;
+
+	fS_ConversionTimes total;
+	for (int i = 0; i < threadCount; i++)
+		total.add(threadTimes[i]);
+	double stagesTotal = total.parse + total.state + total.distance + total.model + total.f0;
+
+	cerr << "genotypes: " << converted + failed << " (" << failed << " failed)" << endl;
+	cerr << "threads: " << threadCount << endl;
+	cerr.precision(1);
+	cerr << "throughput: " << std::fixed << (seconds > 0 ? (converted + failed) / seconds : 0) << " genotypes/s" << endl;
+	cerr << "stage times, summed over threads:" << endl;
+	printStage("parse", total.parse, stagesTotal);
+	printStage("state", total.state, stagesTotal);
+	printStage("distance", total.distance, stagesTotal);
+	printStage("model", total.model, stagesTotal);
+	printStage("f0", total.f0, stagesTotal);
+	return failed > 0 ? 2 : 0;
+}
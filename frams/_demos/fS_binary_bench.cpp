@@ -0,0 +1,183 @@
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "frams/genetics/fS/fS_general.h"
+#include "frams/genetics/fS/fS_oper.h"
+#include "frams/genetics/fS/fS_binary.h"
+#include "frams/genetics/preconfigured.h"
+
+/*
+ * Compares the size and the parsing speed of the text and the binary form of fS genotypes.
+ * The genotypes are read one per line from a file or from standard input. Without arguments, a corpus
+ * is generated by mutating the descendants of a few seed genotypes, like in an evolutionary run.
+ * Every genotype is checked to give the same text after the binary round trip.
+ *
+ * Usage: fS_binary_bench [input_file|-] [repetitions]
+ */
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+const char *SEEDS[] = {
+		"1.1:EcE[N'1]cRbC[G'0]bC[N'0'1]{x=1.02;y=1.02;z=1.03}",
+		"1.1:RcR[N'0]bR[N'0'1]",
+		"1.1:E(cE(bE[T;T'1'2]^cE^bC[N'0]^cR)^bE[N'0'2;N'0'2]^cE(bcE^bcE[N;N'0'1'2])^E)",
+		"1.1:E[Sin'2:2.0;T'0:3.0;T'0:4.0'1:5.0]",
+};
+const int SEED_COUNT = sizeof(SEEDS) / sizeof(SEEDS[0]);
+const int GENERATED_COUNT = 10000;
+
+vector<string> generateCorpus()
+{
+	GenoOper_fS operators;
+	vector<string> corpus(SEEDS, SEEDS + SEED_COUNT);
+	while (int(corpus.size()) < GENERATED_COUNT)
+	{
+		// Recent genotypes are mutated more often, so the corpus contains long lineages
+		int parent = int(corpus.size()) - 1 - randomUint(operators.getRandomGenerator(), std::min(int(corpus.size()), 100));
+		char *genotype = strdup(corpus[parent].c_str());
+		float chg;
+		int method;
+		if (operators.mutate(genotype, chg, method) == GENOPER_OK && operators.checkValidity(genotype, "") == 0)
+			corpus.push_back(genotype);
+		free(genotype);
+	}
+	return corpus;
+}
+
+bool readCorpus(const char *inputName, vector<string> &corpus)
+{
+	std::ifstream file;
+	std::istream *input = &std::cin;
+	if (strcmp(inputName, "-") != 0)
+	{
+		file.open(inputName);
+		if (!file)
+			return false;
+		input = &file;
+	}
+	string line;
+	while (std::getline(*input, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			corpus.push_back(line);
+	}
+	return true;
+}
+
+void printTime(const char *name, double nanoseconds, int count)
+{
+	cout.precision(3);
+	cout << "  " << name << ": " << std::fixed << nanoseconds / 1e6 << " ms (" << (count > 0 ? nanoseconds / count : 0) << " ns/genotype)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	PreconfiguredGenetics genetics;
+
+	int repetitions = argc > 2 ? atoi(argv[2]) : 5;
+	if (repetitions <= 0)
+		repetitions = 1;
+	vector<string> corpus;
+	if (argc > 1)
+	{
+		if (!readCorpus(argv[1], corpus))
+		{
+			cerr << "Can not open " << argv[1] << endl;
+			return 1;
+		}
+	}
+	else
+		corpus = generateCorpus();
+
+	// Genotypes are normalized by writing them, so that both forms describe the same values
+	vector<string> texts, binaries;
+	int invalid = 0;
+	for (int i = 0; i < int(corpus.size()); i++)
+	{
+		try
+		{
+			fS_Genotype genotype(corpus[i]);
+			texts.push_back(genotype.getGeno().c_str());
+			binaries.push_back(string());
+			fS_BinaryCodec::encode(genotype, binaries.back());
+		}
+		catch (fS_Exception &e)
+		{
+			invalid++;
+		}
+	}
+
+	long textSize = 0, binarySize = 0;
+	int mismatches = 0;
+	for (int i = 0; i < int(texts.size()); i++)
+	{
+		textSize += texts[i].length();
+		binarySize += binaries[i].length();
+		fS_Genotype *decoded = fS_BinaryCodec::decode(binaries[i].c_str(), int(binaries[i].length()));
+		if (texts[i] != decoded->getGeno().c_str())
+			mismatches++;
+		delete decoded;
+	}
+
+	double textParse = 0, binaryParse = 0, textWrite = 0, binaryWrite = 0;
+	long checksum = 0;
+	for (int r = 0; r < repetitions; r++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < int(texts.size()); i++)
+		{
+			fS_Genotype genotype(texts[i]);
+			checksum += genotype.getNodeCount();
+		}
+		textParse += fS_elapsedNanoseconds(start);
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < int(binaries.size()); i++)
+		{
+			fS_Genotype *genotype = fS_BinaryCodec::decode(binaries[i].c_str(), int(binaries[i].length()));
+			checksum -= genotype->getNodeCount();
+			delete genotype;
+		}
+		binaryParse += fS_elapsedNanoseconds(start);
+	}
+
+	// Writing is measured on parsed genotypes, without the caches that getGeno() would reuse
+	vector<fS_Genotype *> parsed;
+	for (int i = 0; i < int(texts.size()); i++)
+		parsed.push_back(new fS_Genotype(texts[i]));
+	auto start = std::chrono::steady_clock::now();
+	string binary;
+	for (int i = 0; i < int(parsed.size()); i++)
+	{
+		binary.clear();
+		fS_BinaryCodec::encode(*parsed[i], binary);
+	}
+	binaryWrite = fS_elapsedNanoseconds(start);
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < int(parsed.size()); i++)
+		checksum += parsed[i]->getGeno().length();
+	textWrite = fS_elapsedNanoseconds(start);
+	for (int i = 0; i < int(parsed.size()); i++)
+		delete parsed[i];
+
+	int count = int(texts.size());
+	cout << "genotypes: " << count << " (" << invalid << " invalid skipped, " << mismatches << " round trip mismatches)" << endl;
+	cout.precision(1);
+	cout << "text size: " << textSize << " bytes (" << std::fixed << (count > 0 ? double(textSize) / count : 0) << " per genotype)" << endl;
+	cout << "binary size: " << binarySize << " bytes (" << (textSize > 0 ? 100.0 * binarySize / textSize : 0) << "% of text)" << endl;
+	cout << "parse, " << repetitions << " repetitions:" << endl;
+	printTime("text", textParse, count * repetitions);
+	printTime("binary", binaryParse, count * repetitions);
+	cout << "write:" << endl;
+	printTime("text", textWrite, count);
+	printTime("binary", binaryWrite, count);
+	cout << "checksum: " << checksum << endl;
+	return mismatches > 0 ? 2 : 0;
+}
@@ -2,10 +2,15 @@
 #include <stdio.h>
 #include <assert.h>
 #include <chrono>
+#include <filesystem>
+#include <set>
 #include <common/nonstd_math.h>
 #include "frams/genetics/fS/fS_general.h"
 #include "frams/genetics/fS/fS_conv.h"
 #include "frams/genetics/fS/fS_oper.h"
+#include "frams/genetics/fS/fS_store.h"
+#include "frams/genetics/fS/fS_binary.h"
+#include "frams/genetics/fS/fS_archive.h"
 #include "frams/genetics/preconfigured.h"
 
 using std::cout;
@@ -72,19 +77,20 @@ void testRearrangeBeforeCrossover()
 			"1.1:E[N'1'3;N'2'4;N](E[N'3;N'4'5;N'3]^E[N'3;N'4'6'7])",
 			"1.1:E[N'1'3;N'2'4;N](E[N'0'3;N'4'5;N'3'6]^E[N'3;N'4'6'7])",
 	};
-	int expectedSubStart[] = {
-			0, 3, 3, 3, 3, 3, 3, 3, 3
-	};
 	for (int i = 0; i < int(sizeof(test_cases) / sizeof(test_cases[0])); i++)
 	{
 		fS_Genotype geno(test_cases[i]);
 		Node *subtree = geno.getAllNodes()[1];
-		int subStart;
 
-		operators.rearrangeConnectionsBeforeCrossover(&geno, subtree, subStart);
+		operators.rearrangeConnectionsBeforeCrossover(&geno, subtree);
 
 		cout<<geno.getGeno().c_str()<<endl;
-		ensure(subStart == expectedSubStart[i]);
+		// No neuron can have inputs from the subtree
+		vector < fS_Neuron * > allNeurons = geno.getAllNeurons();
+		vector < fS_Neuron * > subNeurons = fS_Genotype::extractNeurons(subtree);
+		for (int j = 0; j < int(allNeurons.size()); j++)
+			for (int k = 0; k < int(subNeurons.size()); k++)
+				ensure(!allNeurons[j]->inputs.contains(subNeurons[k]->id));
 	}
 }
 
@@ -98,15 +104,14 @@ void testRearrangeAfterCrossover()
 			"1.1:E[N'0'1;N'0](E[Rnd;N;N]^E[N'2'3;N'2])",
 			"1.1:E[N'0'1;N'0](E[Rnd;N;N]^E[N'2'3;N'2]C[N'2'4])",
 	};
-	int subStart[] {
-			0, 0, 0, 0, 0,
-	};
 	for (int i = 0; i < int(sizeof(test_cases) / sizeof(test_cases[0])); i++)
 	{
 		fS_Genotype geno(test_cases[i]);
 		Node *subtree = geno.getAllNodes()[1];
 
-		operators.rearrangeConnectionsAfterCrossover(&geno, subtree, subStart[i]);
+		// Exchange the subtree with itself
+		operators.rearrangeConnectionsBeforeCrossover(&geno, subtree);
+		operators.rearrangeConnectionsAfterCrossover(&geno, subtree);
 
 		cout<<geno.getGeno().c_str()<<endl;
 	}
@@ -196,17 +201,17 @@ void testUsePartType()
 	cylinder.push_back(Part::Shape::SHAPE_CYLINDER);
 
 	fS_Genotype geno("1.1:E");
-	ensure(geno.getAllNodes()[0]->partShape == Part::Shape::SHAPE_ELLIPSOID);
+	ensure(geno.getAllNodes()[0]->getPartShape() == Part::Shape::SHAPE_ELLIPSOID);
 	operators.changePartType(geno, cylinder);
-	ensure(geno.getAllNodes()[0]->partShape == Part::Shape::SHAPE_CYLINDER);
+	ensure(geno.getAllNodes()[0]->getPartShape() == Part::Shape::SHAPE_CYLINDER);
 	operators.addPart(geno, cylinder);
-	ensure(geno.getAllNodes()[1]->partShape == Part::Shape::SHAPE_CYLINDER);
+	ensure(geno.getAllNodes()[1]->getPartShape() == Part::Shape::SHAPE_CYLINDER);
 	operators.removePart(geno);
 	operators.addPart(geno, cuboid);
-	ensure(geno.getAllNodes()[1]->partShape == Part::Shape::SHAPE_CUBOID);
+	ensure(geno.getAllNodes()[1]->getPartShape() == Part::Shape::SHAPE_CUBOID);
 	operators.removePart(geno);
 	operators.addPart(geno, ellipsoid);
-	ensure(geno.getAllNodes()[1]->partShape == Part::Shape::SHAPE_ELLIPSOID);
+	ensure(geno.getAllNodes()[1]->getPartShape() == Part::Shape::SHAPE_ELLIPSOID);
 
 }
 
@@ -246,6 +251,124 @@ void testCrossoverSimilarTrees()
 	}
 }
 
+void testSubtreeSizes()
+{
+	GenoOper_fS operators;
+	fS_Genotype geno("1.1:E(E(E^E)^E^E(E^E)^E)");
+	for (int i = 0; i < 20; i++)
+	{
+		if (i % 3 == 2)
+			operators.removePart(geno);
+		else
+			operators.addPart(geno, availablePartShapes, false);
+		// Cached subtree sizes must match the ones of a freshly parsed genotype
+		fS_Genotype parsed(geno.getGeno().c_str());
+		ensure(geno.getNodeCount() == int(geno.getAllNodes().size()));
+		std::map<int, vector<Node *>> cached = geno.getNodesBySubtreeSize(), actual = parsed.getNodesBySubtreeSize();
+		ensure(cached.size() == actual.size());
+		for (auto it = cached.begin(); it != cached.end(); ++it)
+			ensure(it->second.size() == actual[it->first].size());
+	}
+
+	std::map<int, vector<Node *>> nodesBySize = geno.getNodesBySubtreeSize();
+	const vector<Node *> *bucket;
+	ensure(GenoOper_fS::findMostSimilarSize(nodesBySize, 1, bucket) == 1.0);
+	ensure((*bucket)[0]->getNodeCount() == 1);
+	ensure(GenoOper_fS::findMostSimilarSize(nodesBySize, 1000, bucket) == 1000.0 / geno.getNodeCount());
+	ensure((*bucket)[0] == geno.startNode);
+}
+
+void testGenoWriter()
+{
+	fS_GenoWriter writer;
+	double values[] = {3.0, 1.23456, -0.5, 100.0, 0.00004, -0.00004, 0.1, 12345.00001};
+	const char *expected[] = {"3", "1.2346", "-0.5", "100", "0", "-0", "0.1", "12345"};
+	for (int i = 0; i < int(sizeof(values) / sizeof(values[0])); i++)
+	{
+		writer.clear();
+		writer.writeFixed(values[i], 4);
+		ensure(strcmp(writer.c_str(), expected[i]) == 0);
+	}
+
+	// The genotypes were written with doubleToString() before, so the texts must not change
+	double moreValues[] = {0.0, 3.0, 1.23456, -0.5, 100.0, 0.00004, -0.00004, 0.125, -2.675, 1e-9, 0.999999, 9.5, -1234.5678, 1.0 / 3};
+	for (int precision = 0; precision <= 8; precision++)
+		for (int i = 0; i < int(sizeof(moreValues) / sizeof(moreValues[0])); i++)
+		{
+			writer.clear();
+			writer.writeFixed(moreValues[i], precision);
+			ensure(doubleToString(moreValues[i], precision) == writer.c_str());
+		}
+
+	int integers[] = {0, 7, -12, 2147483647, -2147483647 - 1};
+	const char *expectedIntegers[] = {"0", "7", "-12", "2147483647", "-2147483648"};
+	for (int i = 0; i < int(sizeof(integers) / sizeof(integers[0])); i++)
+	{
+		writer.clear();
+		writer.writeInt(integers[i]);
+		ensure(strcmp(writer.c_str(), expectedIntegers[i]) == 0);
+	}
+}
+
+void testGenoCache()
+{
+	GenoOper_fS operators;
+	fS_Genotype geno("1.1:E[N]{x=1.5}E(bE{ry=0.78}^cC[T'0]{s=1.1})");
+	int precision = fS_Genotype::precision;
+	for (int i = 0; i < 90; i++)
+	{
+		switch (i % 9)
+		{
+			case 0: operators.changeParam(geno); break;
+			case 1: operators.addParam(geno); break;
+			case 2: operators.removeParam(geno); break;
+			case 3: operators.changeModifier(geno); break;
+			case 4: operators.changeJoint(geno); break;
+			case 5: operators.changePartType(geno, availablePartShapes); break;
+			case 6: operators.addPart(geno, availablePartShapes); break;
+			case 7: operators.addNeuro(geno); break;
+			case 8: operators.removePart(geno); break;
+		}
+		SString cached = geno.getGeno();
+		// Changing the precision forces all the nodes to be written anew
+		fS_Genotype::precision = precision + 1;
+		geno.getGeno();
+		fS_Genotype::precision = precision;
+		ensure(cached == geno.getGeno());
+	}
+}
+
+void testRollback()
+{
+	GenoOper_fS operators;
+	fS_Genotype geno("1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E)");
+	SString original = geno.getGeno();
+	for (int i = 0; i < 10 * FS_OPCOUNT; i++)
+	{
+		int mark = geno.beginEdits();
+		operators.performMutation(geno, i % FS_OPCOUNT, availablePartShapes);
+		geno.rollbackEdits(mark);
+		ensure(geno.getGeno() == original);
+		ensure(geno.getNodeCount() == int(geno.getAllNodes().size()));
+	}
+
+	// Committed inner edits are reverted by the outer rollback
+	int mark = geno.beginEdits();
+	geno.beginEdits();
+	operators.addPart(geno, availablePartShapes);
+	geno.commitEdits();
+	operators.addNeuro(geno);
+	ensure(geno.getGeno() != original);
+	geno.rollbackEdits(mark);
+	ensure(geno.getGeno() == original);
+
+	// Committed edits are permanent
+	geno.beginEdits();
+	operators.addPart(geno, availablePartShapes);
+	geno.commitEdits();
+	ensure(geno.getNodeCount() == 6);
+}
+
 void testAllPartScalesValid()
 {
 	string test_cases[] = {
@@ -321,14 +444,14 @@ void testOneGenotype(SString test, int expectedPartCount)
 	// Test change joint
 	char firstJoint;
 	if(geno.getNodeCount() == 2)
-		firstJoint = geno.getAllNodes()[1]->joint;
+		firstJoint = geno.getAllNodes()[1]->getJoint();
 	tmpStr = geno.getGeno();
 	if (operators.changeJoint(geno))
 	{
 		ensure(tmpStr != geno.getGeno());
 		if(geno.getNodeCount() == 2)
 			// If there are only 2 nodes, we know which joint has been changed
-			ensure(geno.getAllNodes()[1]->joint != firstJoint);
+			ensure(geno.getAllNodes()[1]->getJoint() != firstJoint);
 	}
 
 	// Test add param
@@ -402,6 +525,7 @@ void validationTest()
 			"1.1:E{f=fr}",    // Wrong param value
 			"1.1:E[G'w'2]",    // Invalid neuro connection key
 			"1.1:E[G'1:w'2]",    // Invalid neuro connection value
+			"1.1:E[G'1'']",    // Empty neuro connection key
 			"1.1:E{",    // Lacking param end
 			"1.1:E[",    // Lacking neuro end
 			"1.1:E{x=1.5;y=0.0}",    // Lacking param end
@@ -415,7 +539,7 @@ void validationTest()
 	};
 	int errorIndexes[] = {
 			5, 5, 5, 6,
-			6, 8, 8, 7, 7,
+			6, 8, 8, 7, 7, 7,
 			6, 6, 14, 1, 1,
 			1, 1, 1, 1, 1
 	};
@@ -430,23 +554,12 @@ void validationTest()
 
 void testRearrangeInputs()
 {
-	const int size = 6;
+	const int size = 3;
 	string before = "1.1:E[T]bE[N'2'3]cRbC[T;G'1'2]bE[N'1'2'3;T]{x=3.0;y=3.0;z=3.0}";
-	SHIFT shift[size]{
-			SHIFT::RIGHT,
-			SHIFT::RIGHT,
-			SHIFT::RIGHT,
-			SHIFT::LEFT,
-			SHIFT::LEFT,
-			SHIFT::LEFT,
-	};
 	int neuronNumber[size]{
 			0,    // First
 			2,   // Middle
 			5,    // Last
-			0,
-			2,
-			5
 	};
 
 	for (int i = 0; i < size; i++)
@@ -455,13 +568,38 @@ void testRearrangeInputs()
 		vector < fS_Neuron * > allNeurons = geno.getAllNeurons();
 		fS_Neuron *neuron = allNeurons[neuronNumber[i]];
 
-		geno.rearrangeNeuronConnections(neuron, shift[i]);
+		// Identifiers of parsed neurons are equal to their positions
+		vector<int> positions = geno.getNeuronPositions();
+		for (int j = 0; j < int(allNeurons.size()); j++)
+			ensure(positions[allNeurons[j]->id] == j);
+
+		geno.removeConnectionsFrom({neuron});
 
 		cout<<geno.getGeno().c_str()<<endl;
 	}
 
 }
 
+void testNeuronIdCompaction()
+{
+	// The identifiers of removed neurons are not reused, but the positions stay proportional to the number of neurons
+	fS_Genotype geno("1.1:E[N;T'0]E[N'1:2.5]");
+	SString original = geno.getGeno();
+	Node *node = geno.getAllNodes()[1];
+	for (int i = 0; i < 1000; i++)
+	{
+		fS_Neuron *neuron = new fS_Neuron("N", 0, 1);
+		geno.addNeuron(node, neuron);
+		neuron->inputs.set(geno.getAllNeurons()[0]->id, 3.0);
+		fS_Genotype parsed(geno.getGeno().c_str());
+		fS_Neuron *added = parsed.getAllNeurons()[3];
+		ensure(added->inputs.size() == 1 && added->inputs.getId(0) == 0 && added->inputs.getWeight(0) == 3.0);
+		geno.removeNeuron(node, 1);
+		ensure(int(geno.getNeuronPositions().size()) <= 2 * 3 + MIN_NEURON_IDS_TO_COMPACT);
+	}
+	ensure(geno.getGeno() == original);
+}
+
 void testMutateSizeParam()
 {
 	GenoOper_fS operators;
@@ -485,7 +623,7 @@ void testMutateSizeParam()
 			geno.getState(false);
 			std::cout<<test_cases[i]	<<std::endl;
 
-			bool result = operators.mutateScaleParam(geno.startNode, SCALE_PARAMS[j], false);
+			bool result = operators.mutateScaleParam(geno, geno.startNode, SCALE_PARAMS[j], false);
 
 			geno.getState(false);
 			double volume = geno.startNode->calculateVolume();
@@ -499,6 +637,657 @@ void testMutateSizeParam()
 	}
 }
 
+void testFeasibleScaleRange()
+{
+	GenoOper_fS operators;
+	SString test_cases[] = {
+			"1.1:C{x=0.5;y=2.0}",
+			"1.1:R{x=3.0}",
+			"1.1:E",
+			"1.1:C{s=4.0;x=0.3;y=0.3;z=0.3}",
+	};
+	for (int i = 0; i < int(sizeof(test_cases) / sizeof(test_cases[0])); i++)
+	{
+		fS_Genotype geno(test_cases[i].c_str());
+		for (int j = 0; j < 100; j++)
+		{
+			string key = SCALE_PARAMS[j % SCALE_PARAMS.size()];
+			SString before = geno.getGeno();
+			geno.getState(false);
+			bool result = operators.mutateScaleParam(geno, geno.startNode, key, true);
+			geno.getState(false);
+			// The part stays valid and only the parameters tied by the circle section cannot be changed
+			ensure(geno.checkValidityOfPartSizes() == 0);
+			bool isTied = key != SCALE && key != SCALE_X && geno.startNode->getPartShape() != Part::Shape::SHAPE_CUBOID;
+			if (geno.startNode->getPartShape() == Part::Shape::SHAPE_ELLIPSOID && key == SCALE_X)
+				isTied = true;
+			ensure(result != isTied);
+			ensure(result == (before != geno.getGeno()));
+		}
+	}
+}
+
+void testOperatorStats()
+{
+	GenoOper_fS operators;
+	for (int i = 0; i < 50; i++)
+	{
+		char *g = strdup("1.1:EcE[N'1]cRbC[G'0]{x=1.1}");
+		float chg;
+		int method;
+		operators.mutate(g, chg, method);
+		free(g);
+	}
+	long attempts = 0, successes = 0;
+	for (int i = 0; i <= FS_OPCOUNT; i++)
+	{
+		const fS_OperatorStats &stats = operators.stats[i];
+		ensure(stats.attempts == stats.successes + stats.failures);
+		ensure(stats.retries <= stats.attempts);
+		attempts += stats.attempts;
+		successes += stats.successes;
+	}
+	// Every mutation either succeeded with one of the operators or was counted as failed
+	ensure(successes + operators.mutationFailures == 50);
+	ensure(attempts >= 50);
+
+	operators.resetStats();
+	for (int i = 0; i <= FS_OPCOUNT; i++)
+		ensure(operators.stats[i].attempts == 0 && operators.stats[i].nanoseconds == 0);
+	ensure(operators.mutationFailures == 0);
+}
+
+void testAdaptiveProbabilities()
+{
+	GenoOper_fS operators;
+	operators.adaptiveProbabilities = 1;
+	operators.prob[FS_ADD_NEURO] = 0.0;
+	for (int i = 0; i < 300; i++)
+	{
+		char *g = strdup("1.1:E");
+		float chg;
+		int method;
+		if (operators.mutate(g, chg, method) == GENOPER_OK)
+			ensure(method != FS_ADD_NEURO);
+		free(g);
+	}
+	ensure(GenoOper_fS::getSizeClass(1) == 0);
+	ensure(GenoOper_fS::getSizeClass(3) == 1);
+	ensure(GenoOper_fS::getSizeClass(1000) == FS_SIZE_CLASSES - 1);
+
+	// A single part without neurons cannot lose a part or a neuron, so these mutations never add a success to the initial one
+	const fS_AdaptiveRecord *records = operators.adaptive[0];
+	ensure(records[FS_REM_PART].successes <= 1 && records[FS_REM_PART].attempts > 2);
+	ensure(records[FS_REM_NEURO].successes <= 1 && records[FS_REM_NEURO].attempts > 2);
+	ensure(records[FS_MOD_MOD].successes > 0.9 * records[FS_MOD_MOD].attempts);
+
+	double probabilities[FS_OPCOUNT];
+	operators.getAdaptiveProbabilities(0, probabilities);
+	for (int i = 0; i < FS_OPCOUNT; i++)
+	{
+		// The configured probabilities are only scaled within bounds
+		ensure(probabilities[i] >= operators.prob[i] * ADAPTIVE_MIN_FACTOR);
+		ensure(probabilities[i] <= operators.prob[i] * ADAPTIVE_MAX_FACTOR);
+	}
+	ensure(probabilities[FS_ADD_NEURO] == 0.0);
+
+	// Without any results all the mutation types get the same factor
+	operators.resetAdaptive();
+	operators.getAdaptiveProbabilities(0, probabilities);
+	for (int i = 0; i < FS_OPCOUNT; i++)
+		ensure(probabilities[i] == operators.prob[i] * 0.5);
+}
+
+void testProduceOffspring()
+{
+	GenoOper_fS operators;
+	vector<string> parents = {
+			"1.1:EcE[N'1]cRbC[G'0]{x=1.1}",
+			"1.1:RcR[N'0]bR[N'0'1]",
+			"1.1:E(cE^bC^E{x=1.5})",
+			"1.1:C{x=0.5;y=2.0}",
+	};
+	vector<fS_OffspringTask> plan;
+	for (int i = 0; i < 40; i++)
+		plan.push_back({i % 4, i % 3 == 0 ? (i + 1) % 4 : -1});
+
+	// The offspring do not depend on the number of threads
+	vector<fS_Offspring> serial = operators.produceOffspring(parents, plan, 7, 1);
+	vector<fS_Offspring> parallel = operators.produceOffspring(parents, plan, 7, 4);
+	ensure(serial.size() == plan.size() && parallel.size() == plan.size());
+	bool anyChanged = false;
+	for (int i = 0; i < int(plan.size()); i++)
+	{
+		ensure(serial[i].result == parallel[i].result && serial[i].method == parallel[i].method);
+		for (int j = 0; j < PARENT_COUNT; j++)
+			ensure(serial[i].genotypes[j] == parallel[i].genotypes[j] && serial[i].chg[j] == parallel[i].chg[j]);
+		if (plan[i].parent1 < 0)
+			ensure(serial[i].method >= 0 && serial[i].method < FS_OPCOUNT && serial[i].genotypes[1].empty());
+		else
+			ensure(serial[i].method == FS_STATS_CROSSOVER);
+		if (serial[i].genotypes[0] != parents[plan[i].parent0])
+			anyChanged = true;
+	}
+	ensure(anyChanged);
+	ensure(operators.stats[FS_STATS_CROSSOVER].attempts == 2 * 14);
+
+	vector<fS_Offspring> other = operators.produceOffspring(parents, plan, 8, 4);
+	bool anyDifferent = false;
+	for (int i = 0; i < int(plan.size()); i++)
+		anyDifferent |= other[i].genotypes[0] != serial[i].genotypes[0];
+	ensure(anyDifferent);
+
+	// In the adaptive mode, the tasks use the state from before the batch, and the batch is learned afterwards
+	operators.adaptiveProbabilities = 1;
+	operators.resetAdaptive();
+	serial = operators.produceOffspring(parents, plan, 7, 1);
+	double learnedAttempts = 0;
+	for (int i = 0; i < FS_SIZE_CLASSES; i++)
+		for (int j = 0; j < FS_OPCOUNT; j++)
+			learnedAttempts += operators.adaptive[i][j].timedAttempts;
+	ensure(learnedAttempts >= 26);
+	operators.resetAdaptive();
+	parallel = operators.produceOffspring(parents, plan, 7, 4);
+	for (int i = 0; i < int(plan.size()); i++)
+		ensure(serial[i].method == parallel[i].method && serial[i].genotypes[0] == parallel[i].genotypes[0]);
+}
+
+void testBuildModelDirectly()
+{
+	SString test_cases[] = {
+			"1.1:EcE[N'1]cRbC[G'0]{x=1.1}",
+			"1.1:E(cE^bC^E{x=1.5})",
+			"1.1:C{x=0.5;y=2.0}",
+	};
+	// The same model is reused, every build replaces its contents
+	Model model;
+	for (int i = 0; i < int(sizeof(test_cases) / sizeof(test_cases[0])); i++)
+	{
+		fS_Genotype geno(test_cases[i].c_str());
+		ensure(GenoConv_fS0s::buildModel(test_cases[i], model));
+		ensure(model.getPartCount() == geno.getNodeCount());
+		ensure(model.getJointCount() == geno.getNodeCount() - 1);
+		ensure(model.getNeuroCount() == int(geno.getAllNeurons().size()));
+		// The mapping is built only when requested
+		ensure(model.getPart(0)->getMapping() == nullptr);
+		MultiMap map;
+		ensure(GenoConv_fS0s::buildModel(test_cases[i], model, &map));
+		for (int j = 0; j < model.getPartCount(); j++)
+			ensure(model.getPart(j)->getMapping() != nullptr);
+		for (int j = 0; j < model.getJointCount(); j++)
+			ensure(model.getJoint(j)->getMapping() != nullptr);
+		for (int j = 0; j < model.getNeuroCount(); j++)
+			ensure(model.getNeuro(j)->getMapping() != nullptr);
+	}
+	ensure(!GenoConv_fS0s::buildModel("1.1:E[N'5]", model));
+	ensure(model.getPartCount() == 0);
+}
+
+void testDevelopmentLog()
+{
+	SString test_cases[] = {
+			"1.1:EcE[N'1]cRbC[G'0]{x=1.1}",
+			"1.1:E(cE^bC[N]^E{x=1.5})",
+			"1.1:C{x=0.5;y=2.0}",
+	};
+	for (int i = 0; i < int(sizeof(test_cases) / sizeof(test_cases[0])); i++)
+	{
+		fS_Genotype geno(test_cases[i].c_str());
+		Model model;
+		vector<fS_DevelopmentStep> developmentLog;
+		geno.buildModel(model, developmentLog);
+		ensure(!model.isUsingCheckpoints() && model.getCheckpointCount() == 0);
+		ensure(int(developmentLog.size()) == geno.getNodeCount());
+
+		// Each checkpoint built on demand matches the one stored by the model built with checkpoints,
+		// and its parts are where the states of the nodes, calculated independently of the log, put them
+		Model withCheckpoints = geno.buildModel(true);
+		ensure(withCheckpoints.getCheckpointCount() == geno.getNodeCount());
+		vector<Node *> nodes = geno.getAllNodes();
+		geno.getState(true);
+		for (int step = 0; step < int(developmentLog.size()); step++)
+		{
+			Model checkpoint;
+			fS_Genotype::buildCheckpoint(checkpoint, developmentLog, step);
+			Model *stored = withCheckpoints.getCheckpoint(step);
+			ensure(checkpoint.getPartCount() == step + 1 && stored->getPartCount() == step + 1);
+			ensure(checkpoint.getJointCount() == step && stored->getJointCount() == step);
+			ensure(checkpoint.getNeuroCount() == stored->getNeuroCount());
+			for (int j = 0; j <= step; j++)
+			{
+				Part *part = checkpoint.getPart(j), *storedPart = stored->getPart(j);
+				ensure(part->shape == storedPart->shape);
+				ensure(part->p.x == storedPart->p.x && part->p.y == storedPart->p.y && part->p.z == storedPart->p.z);
+				ensure(doubleCompare(part->p.x, nodes[j]->state->location.x) && doubleCompare(part->p.y, nodes[j]->state->location.y)
+					   && doubleCompare(part->p.z, nodes[j]->state->location.z));
+				ensure(part->scale.x == storedPart->scale.x && part->scale.y == storedPart->scale.y && part->scale.z == storedPart->scale.z);
+			}
+		}
+		ensure(model.getPartCount() == geno.getNodeCount() && model.getJointCount() == geno.getNodeCount() - 1);
+	}
+}
+
+void testUpdateModel()
+{
+	GenoOper_fS operators;
+	fS_Genotype geno("1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E(E^C{rz=0.3}))");
+	Model model;
+	geno.buildModel(model, false);
+	for (int i = 0; i < 10 * FS_OPCOUNT; i++)
+	{
+		int method = i % FS_OPCOUNT;
+		operators.performMutation(geno, method, availablePartShapes);
+		bool updated = geno.updateModel(model);
+		// Changes of a single node's properties are applied in place, other changes build the model again
+		if (method >= FS_MOD_PART && method <= FS_MOD_MOD)
+			ensure(updated);
+
+		Model rebuilt;
+		geno.buildModel(rebuilt, false, false);
+		ensure(model.getPartCount() == rebuilt.getPartCount() && model.getJointCount() == rebuilt.getJointCount());
+		ensure(model.getNeuroCount() == rebuilt.getNeuroCount());
+		for (int j = 0; j < model.getPartCount(); j++)
+		{
+			Part *part = model.getPart(j), *expected = rebuilt.getPart(j);
+			ensure(part->shape == expected->shape && part->p == expected->p && part->scale == expected->scale);
+			ensure(part->friction == expected->friction && part->ingest == expected->ingest);
+		}
+		for (int j = 0; j < model.getJointCount(); j++)
+			ensure(model.getJoint(j)->shape == rebuilt.getJoint(j)->shape);
+	}
+}
+
+void testNeutralMutations()
+{
+	const char *same[][2] = {
+			{"1.1:EcE{s=1.0}", "1.1:EcE"},
+			{"1.1:EsSE", "1.1:EE"},
+			{"1.0:EIE", "1.0:EE"},
+			{"1.1:E[N'1;T]E{rx=0.0}", "1.1:E[N'1;T]E"},
+	};
+	const char *different[][2] = {
+			{"1.1:EIE", "1.1:EE"},
+			{"1.1:EE{s=1.1}", "1.1:EE"},
+			{"1.1:E[N]", "1.1:E[G]"},
+			{"1.1:E(E^C)", "1.1:E(C^E)"},
+			{"1.1:E[N'1;T]E", "1.1:E[N'0;T]E"},
+	};
+	for (int i = 0; i < int(sizeof(same) / sizeof(same[0])); i++)
+	{
+		fS_Genotype geno0(same[i][0]), geno1(same[i][1]);
+		ensure(geno0.hasSamePhenotype(geno1) && geno1.hasSamePhenotype(geno0));
+	}
+	for (int i = 0; i < int(sizeof(different) / sizeof(different[0])); i++)
+	{
+		fS_Genotype geno0(different[i][0]), geno1(different[i][1]);
+		ensure(!geno0.hasSamePhenotype(geno1) && !geno1.hasSamePhenotype(geno0));
+	}
+
+	// Neutral mutations build the same model as the parent
+	GenoOper_fS operators;
+	const char *parents[] = {"1.0:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E)", "1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC{s=1.1}E)"};
+	int neutralCount[2] = {0, 0};
+	for (int i = 0; i < 400; i++)
+	{
+		char *geno = strdup(parents[i % 2]);
+		float chg;
+		int method;
+		bool neutral;
+		if (operators.mutate(geno, chg, method, neutral) == GENOPER_OK && neutral)
+		{
+			neutralCount[i % 2]++;
+			ensure(method != FS_ADD_PART && method != FS_REM_PART && method < FS_ADD_NEURO);
+			Model parentModel, model;
+			ensure(GenoConv_fS0s::buildModel(parents[i % 2], parentModel) && GenoConv_fS0s::buildModel(geno, model));
+			ensure(parentModel.getF0Geno().getGenes() == model.getF0Geno().getGenes());
+		}
+		free(geno);
+	}
+	// With the modifier multiplier of 1, changing a modifier is always neutral
+	ensure(neutralCount[0] > 0);
+}
+
+void testHash()
+{
+	// Equal subtrees have equal hashes, wherever they are
+	fS_Genotype geno("1.1:E(cE[N]{x=1.5}^E(cE[N]{x=1.5}))");
+	vector<Node *> nodes = geno.getAllNodes();
+	ensure(nodes[1]->getHash() == nodes[3]->getHash());
+	ensure(nodes[1]->getHash() != nodes[2]->getHash());
+
+	// Values that are written the same way have equal hashes, in the genotype params too
+	int precision = fS_Genotype::precision;
+	fS_Genotype::precision = 2;
+	fS_Genotype half("1.125,0,0.125:E{x=0.125}"), rounded("1.12,0,0.12:E{x=0.12}");
+	ensure(half.getGeno() == rounded.getGeno() && half.getHash() == rounded.getHash());
+	fS_Genotype::precision = precision;
+
+	// The cached hashes are invalidated by edits and by rolling them back
+	GenoOper_fS operators;
+	fS_Genotype edited("1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E)");
+	for (int i = 0; i < 20 * FS_OPCOUNT; i++)
+	{
+		uint64_t before = edited.getHash();
+		int mark = edited.beginEdits();
+		operators.performMutation(edited, i % FS_OPCOUNT, availablePartShapes);
+		if (i % 3 == 0)
+		{
+			edited.rollbackEdits(mark);
+			ensure(edited.getHash() == before);
+		}
+		else
+			edited.commitEdits();
+		fS_Genotype parsed(edited.getGeno().c_str());
+		ensure(edited.getHash() == parsed.getHash());
+	}
+
+	// No collisions in a corpus of different genotypes
+	std::map<uint64_t, SString> corpus;
+	const char *seeds[] = {"1.1:EcE[N'1]cRbC[G'0]bC[N'0'1]{x=1.02;y=1.02;z=1.03}", "1.1:RcR[N'0]bR[N'0'1]", "1.1:E[Sin'2:2.0;T'0:3.0;T'0:4.0'1:5.0]"};
+	vector<string> population(seeds, seeds + 3);
+	for (int i = 0; i < 3000; i++)
+	{
+		char *g = strdup(population[i % population.size()].c_str());
+		float chg;
+		int method;
+		if (operators.mutate(g, chg, method) == GENOPER_OK && operators.checkValidity(g, "") == 0 && strlen(g) < 500)
+		{
+			fS_Genotype mutant(g);
+			SString text = mutant.getGeno();
+			auto it = corpus.find(mutant.getHash());
+			ensure(it == corpus.end() || it->second == text);
+			corpus[mutant.getHash()] = text;
+			population.push_back(g);
+		}
+		free(g);
+	}
+	ensure(corpus.size() > 1000);
+}
+
+SString getCanonicalGeno(const char *genotype)
+{
+	fS_Genotype geno(genotype);
+	geno.canonicalize();
+	return geno.getGeno();
+}
+
+void testCanonicalForm()
+{
+	const char *same[][2] = {
+			{"1.1:E(cE^bC)", "1.1:E(bC^cE)"},
+			{"1.1:EsSE", "1.1:EE"},
+			{"1.1:EE{s=1.0}", "1.1:EE"},
+			{"1.1:E{x=1.50}", "1.1:E{x=1.5}"},
+			{"1.0:EIE", "1.0:EE"},
+			{"1.1:E(E[N'1]^C[G])", "1.1:E(C[G]^E[N'0])"},
+			{"1.1:E(cE(E^C{s=2.0})^C)", "1.1:E(C^cE(C{s=2.0}^E))"},
+	};
+	const char *different[][2] = {
+			{"1.1:E(cE^bC)", "1.1:E(cC^bE)"},
+			{"1.1:EIE", "1.1:EE"},
+			{"1.1:EE{s=1.1}", "1.1:EE"},
+			{"1.1:E(E[N'1]^C[G])", "1.1:E(E[N]^C[G])"},
+	};
+	for (int i = 0; i < int(sizeof(same) / sizeof(same[0])); i++)
+		ensure(getCanonicalGeno(same[i][0]) == getCanonicalGeno(same[i][1]));
+	for (int i = 0; i < int(sizeof(different) / sizeof(different[0])); i++)
+		ensure(getCanonicalGeno(different[i][0]) != getCanonicalGeno(different[i][1]));
+
+	// The canonical form is canonical, builds a model of the same size and can be rolled back
+	const char *test_cases[] = {"1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E)", "1.1:bE(cE(bE[T;T'1'2]^cE^bC[N'0]^cR)^bE[N'0'2;N'0'2]^cE(bcE^bcE[N;N'0'1'2])^E)"};
+	for (int i = 0; i < int(sizeof(test_cases) / sizeof(test_cases[0])); i++)
+	{
+		SString canonical = getCanonicalGeno(test_cases[i]);
+		ensure(getCanonicalGeno(canonical.c_str()) == canonical);
+		Model model, canonicalModel;
+		ensure(GenoConv_fS0s::buildModel(test_cases[i], model) && GenoConv_fS0s::buildModel(canonical, canonicalModel));
+		ensure(model.getPartCount() == canonicalModel.getPartCount() && model.getNeuroCount() == canonicalModel.getNeuroCount());
+		ensure(model.getConnectionCount() == canonicalModel.getConnectionCount());
+
+		fS_Genotype geno(test_cases[i]);
+		SString original = geno.getGeno();
+		int mark = geno.beginEdits();
+		geno.canonicalize();
+		geno.rollbackEdits(mark);
+		ensure(geno.getGeno() == original);
+	}
+}
+
+/**
+ * Collect the distinct shared nodes of a stored tree; equal subtrees are one node
+ */
+void collectSharedNodes(const fS_SharedNode *node, std::set<const fS_SharedNode *> &result)
+{
+	if (!result.insert(node).second)
+		return;
+	for (const fS_SharedNodePtr &child : node->children)
+		collectSharedNodes(child.get(), result);
+}
+
+void testSubtreeStore()
+{
+	GenoOper_fS operators;
+	fS_SubtreeStore store;
+	vector<fS_StoredGenotype> population;
+	population.push_back(store.store("1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E(E^C{rz=0.3}))"));
+	int nodeCount = population[0].getNodeCount();
+	for (int i = 0; i < 500; i++)
+	{
+		string parent = store.getGeno(population[i % population.size()]).c_str();
+		char *g = strdup(parent.c_str());
+		float chg;
+		int method;
+		if (operators.mutate(g, chg, method) == GENOPER_OK && operators.checkValidity(g, "") == 0)
+		{
+			fS_Genotype mutant(g);
+			population.push_back(store.store(mutant));
+			// The stored genotype is written the same way as the original one
+			ensure(store.getGeno(population.back()) == mutant.getGeno());
+			nodeCount += population.back().getNodeCount();
+		}
+		free(g);
+	}
+	// The descendants of one genotype share most of their subtrees
+	ensure(store.getSharedNodeCount() * 2 < nodeCount);
+
+	// Copies share the tree
+	fS_StoredGenotype copy = population.back();
+	ensure(copy.root == population.back().root && store.getGeno(copy) == store.getGeno(population.back()));
+
+	// Subtrees are freed when no genotype uses them
+	population.clear();
+	std::set<const fS_SharedNode *> distinct;
+	collectSharedNodes(copy.root.get(), distinct);
+	ensure(store.getSharedNodeCount() == int(distinct.size()));
+
+	// Equal subtrees of one genotype are stored once
+	fS_StoredGenotype twins = store.store("1.1:C(C{x=1.234}^C{x=1.234})");
+	ensure(twins.getNodeCount() == 3 && twins.root->children[0] == twins.root->children[1]);
+	ensure(store.getSharedNodeCount() == int(distinct.size()) + 2);
+}
+
+void testBinaryCodec()
+{
+	GenoOper_fS operators;
+	vector<string> corpus {
+			"1.1:E",
+			"1.3,1,0.5:iSfE{s=0.9}bRC{x=1.2;z=1.3}",
+			"1.1:E[Sin:f0=2.0'2:2.5;T'0:3.0;T'0:-4.0'1:5.0]{ry=-1.56;z=2.0}E{ry=1.56;z=2.0}",
+			"1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E(E^C{rz=0.3}))"};
+	for (int i = 0; i < 300; i++)
+	{
+		char *g = strdup(corpus[i % corpus.size()].c_str());
+		float chg;
+		int method;
+		if (operators.mutate(g, chg, method) == GENOPER_OK && operators.checkValidity(g, "") == 0)
+			corpus.push_back(g);
+		free(g);
+	}
+
+	int textSize = 0, binarySize = 0;
+	for (int i = 0; i < int(corpus.size()); i++)
+	{
+		fS_Genotype genotype(corpus[i]);
+		if (i == 0)
+		{
+			genotype.setParam(genotype.startNode, SCALE_X, 1.0 / 3.0);
+			genotype.setParam(genotype.startNode, ROT_Z, -0.0);
+		}
+		string binary;
+		fS_BinaryCodec::encode(genotype, binary);
+		fS_Genotype *decoded = fS_BinaryCodec::decode(binary.c_str(), int(binary.length()));
+		ensure(decoded->getGeno() == genotype.getGeno());
+		ensure(decoded->getNodeCount() == genotype.getNodeCount());
+
+		// The values are rounded like in the text form, so the decoded genotype equals the parsed text
+		fS_Genotype parsed(genotype.getGeno().c_str());
+		string exactDecoded, exactParsed;
+		fS_BinaryCodec::encode(*decoded, exactDecoded, true);
+		fS_BinaryCodec::encode(parsed, exactParsed, true);
+		ensure(exactDecoded == exactParsed);
+		ensure(decoded->getHash() == parsed.getHash());
+		delete decoded;
+
+		// Exact values are kept exactly
+		string exact;
+		fS_BinaryCodec::encode(genotype, exact, true);
+		decoded = fS_BinaryCodec::decode(exact.c_str(), int(exact.length()));
+		string again;
+		fS_BinaryCodec::encode(*decoded, again, true);
+		ensure(again == exact);
+		ensure(decoded->getGeno() == genotype.getGeno());
+		if (i == 0)
+		{
+			ensure(decoded->startNode->getParam(SCALE_X) == 1.0 / 3.0);
+			ensure(std::signbit(decoded->startNode->getParam(ROT_Z)));
+		}
+		delete decoded;
+
+		textSize += genotype.getGeno().length();
+		binarySize += int(binary.length());
+	}
+	ensure(binarySize * 3 < textSize * 2);
+
+	// Truncated or damaged data is rejected
+	fS_Genotype genotype(corpus[2]);
+	string binary;
+	fS_BinaryCodec::encode(genotype, binary);
+	for (int length = 0; length < int(binary.length()); length++)
+	{
+		bool rejected = false;
+		try
+		{
+			delete fS_BinaryCodec::decode(binary.c_str(), length);
+		}
+		catch (fS_Exception &e)
+		{
+			rejected = true;
+		}
+		ensure(rejected);
+	}
+	for (int i = 0; i < int(binary.length()); i++)
+	{
+		string damaged = binary;
+		damaged[i] ^= 0xff;
+		// Damaged data is either rejected or decoded into a genotype that develops into a model
+		fS_Genotype *decoded = nullptr;
+		try
+		{
+			decoded = fS_BinaryCodec::decode(damaged.c_str(), int(damaged.length()));
+		}
+		catch (fS_Exception &e)
+		{
+			continue;
+		}
+		Model model;
+		decoded->buildModel(model, false);
+		ensure(model.getPartCount() == decoded->getNodeCount());
+		for (int j = 0; j < model.getNeuroCount(); j++)
+			ensure(model.getNeuro(j)->getClass() != nullptr);
+		delete decoded;
+	}
+}
+
+void testArchive()
+{
+	const char *path = "fS_test_archive.tmp";
+	vector<string> genotypes {
+			"1.1:E[N'1;T]{x=1.5}E(bE[G]{ry=0.78}^cC[N'0'1]{s=1.1}E(E^C{rz=0.3}))",
+			"1.1:RcR[N'0]bR[N'0'1]",
+			"1.1:E"};
+	fS_ArchiveWriter writer;
+	ensure(writer.open(path));
+	for (int i = 0; i < int(genotypes.size()); i++)
+	{
+		fS_Genotype genotype(genotypes[i]);
+		ensure(writer.add(genotype, 0.5 * i, i - 1, i - 2) == i);
+	}
+	ensure(writer.add("X[|G:1]", "1", -2.5, 0) == 3);
+	writer.close();
+
+	// New records are appended after the existing ones
+	ensure(writer.open(path, true));
+	ensure(writer.getRecordCount() == 4);
+	fS_Genotype genotype(genotypes[0]);
+	ensure(writer.add(genotype, 7.0, 3) == 4);
+	writer.close();
+
+	fS_ArchiveReader reader;
+	ensure(reader.open(path));
+	ensure(reader.getRecordCount() == 5);
+	for (int i = 0; i < int(genotypes.size()); i++)
+	{
+		fS_ArchiveEntry entry = reader.get(i);
+		ensure(entry.kind == fS_ArchiveEntry::BINARY_FS && entry.fitness == 0.5 * i);
+		ensure(entry.parents[0] == i - 1 && entry.parents[1] == i - 2);
+		ensure(reader.getGenes(entry) == fS_Genotype(genotypes[i]).getGeno());
+		fS_Genotype *decoded = reader.getGenotype(entry);
+		ensure(decoded->getGeno() == fS_Genotype(genotypes[i]).getGeno());
+		delete decoded;
+	}
+	fS_ArchiveEntry text = reader.get(3);
+	ensure(text.kind == fS_ArchiveEntry::TEXT && string(text.format, text.formatLength) == "1");
+	ensure(reader.getGenes(text) == "X[|G:1]" && reader.getFitness(3) == -2.5);
+	ensure(reader.get(4).parents[0] == 3 && reader.getFitness(4) == 7.0);
+	bool outOfRange = false;
+	try
+	{
+		reader.get(5);
+	}
+	catch (fS_Exception &e)
+	{
+		outOfRange = true;
+	}
+	ensure(outOfRange);
+	reader.close();
+
+	// The last record was not completely written: the reader rejects it and appending drops it
+	FILE *file = fopen(path, "r+b");
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	std::filesystem::resize_file(path, size - 3);
+	ensure(reader.open(path));
+	ensure(reader.getRecordCount() == 5);
+	bool damaged = false;
+	try
+	{
+		reader.get(4);
+	}
+	catch (fS_Exception &e)
+	{
+		damaged = true;
+	}
+	ensure(damaged && reader.getFitness(3) == -2.5);
+	reader.close();
+	ensure(writer.open(path, true));
+	ensure(writer.getRecordCount() == 4);
+	writer.close();
+
+	remove(path);
+	remove((string(path) + ARCHIVE_INDEX_SUFFIX).c_str());
+}
+
 void testGenotypeParams()
 {
 	int COUNT = 5;
@@ -639,14 +1428,32 @@ int main(int argc, char *argv[])
 
 	testAllPartScalesValid();
 	testRearrangeInputs();
+	testNeuronIdCompaction();
 	validationTest();
 	testCrossoverSimilarTrees();
+	testSubtreeSizes();
+	testGenoWriter();
+	testGenoCache();
+	testRollback();
 	testRearrangeBeforeCrossover();
 	testRearrangeAfterCrossover();
 	testAddPart();
 	testChangePartType();
 	testUsePartType();
 	testMutateSizeParam();
+	testFeasibleScaleRange();
+	testOperatorStats();
+	testAdaptiveProbabilities();
+	testProduceOffspring();
+	testBuildModelDirectly();
+	testDevelopmentLog();
+	testUpdateModel();
+	testNeutralMutations();
+	testHash();
+	testCanonicalForm();
+	testSubtreeStore();
+	testBinaryCodec();
+	testArchive();
 	testGenotypeParams();
 
 	cout << "FINISHED";
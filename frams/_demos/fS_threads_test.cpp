@@ -0,0 +1,116 @@
+#include <iostream>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include <common/nonstd_math.h>
+#include "frams/genetics/fS/fS_general.h"
+#include "frams/genetics/fS/fS_oper.h"
+#include "frams/genetics/preconfigured.h"
+
+/*
+ * Runs fS mutations and crossovers from many threads at once.
+ * Each thread has its own GenoOper_fS with its own random generator and works on its own population.
+ * Build it with -fsanitize=thread (added to both CXXFLAGS and LDFLAGS) to detect data races.
+ * Every other worker uses the adaptive mutation probabilities, which depend on the measured time of operators.
+ * The other workers are seeded and deterministic: each of them is run again alone, and its results must be the same
+ * as in the concurrent run. Their populations must also change and differ from each other, because their seeds differ.
+ * The numbers of successful operations depend on the random generator of the build, so they go to standard error.
+ */
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+const char *SEEDS[] = {
+		"1.1:EcE[N'1]cRbC[G'0]bC[N'0'1]{x=1.02;y=1.02;z=1.03}",
+		"1.1:RcR[N'0]bR[N'0'1]",
+		"1.1:E(cE(bE[T;T'1'2]^cE^bC[N'0]^cR)^bE[N'0'2;N'0'2]^cE(bcE^bcE[N;N'0'1'2])^E)",
+		"1.1:E[Sin'2:2.0;T'0:3.0;T'0:4.0'1:5.0]",
+};
+const int SEED_COUNT = sizeof(SEEDS) / sizeof(SEEDS[0]);
+
+struct WorkerResult
+{
+	int mutations = 0;	/// The number of valid mutants
+	int crossovers = 0;	/// The number of crossovers that gave two valid offspring
+	vector<string> population;	/// The final population
+};
+
+void worker(int index, int operationCount, WorkerResult &result)
+{
+	RandomGenerator generator(index + 1);
+	GenoOper_fS operators;
+	operators.setRandomGenerator(&generator);
+	operators.adaptiveProbabilities = index % 2;
+
+	vector<string> population(SEEDS, SEEDS + SEED_COUNT);
+	for (int i = 0; i < operationCount; i++)
+	{
+		int a = randomUint(generator, population.size());
+		int b = randomUint(generator, population.size());
+		char *g0 = strdup(population[a].c_str());
+		float chg;
+		int method;
+		// Like in evolution, offspring that are not valid are discarded
+		if (operators.mutate(g0, chg, method) == GENOPER_OK && operators.checkValidity(g0, "") == 0)
+		{
+			population[a] = g0;
+			result.mutations++;
+		}
+		free(g0);
+
+		g0 = strdup(population[a].c_str());
+		char *g1 = strdup(population[b].c_str());
+		float chg0, chg1;
+		if (operators.crossOver(g0, g1, chg0, chg1) == GENOPER_OK && operators.checkValidity(g0, "") == 0
+			&& operators.checkValidity(g1, "") == 0 && strlen(g0) < 1000 && strlen(g1) < 1000)
+		{
+			population[a] = g0;
+			population[b] = g1;
+			result.crossovers++;
+		}
+		free(g0);
+		free(g1);
+	}
+	result.population = population;
+}
+
+int main(int argc, char *argv[])
+{
+	PreconfiguredGenetics genetics;
+
+	int threadCount = argc > 1 ? atoi(argv[1]) : 8;
+	int operationCount = argc > 2 ? atoi(argv[2]) : 200;
+
+	vector<WorkerResult> results(threadCount);
+	vector<std::thread> threads;
+	for (int i = 0; i < threadCount; i++)
+		threads.push_back(std::thread(worker, i, operationCount, std::ref(results[i])));
+	for (int i = 0; i < threadCount; i++)
+		threads[i].join();
+
+	int different = 0, unchanged = 0, repeated = 0;
+	vector<string> seeds(SEEDS, SEEDS + SEED_COUNT);
+	cout << "threads: " << threadCount << endl;
+	for (int i = 0; i < threadCount; i += 2)
+	{
+		WorkerResult alone;
+		worker(i, operationCount, alone);
+		if (alone.mutations != results[i].mutations || alone.crossovers != results[i].crossovers || alone.population != results[i].population)
+			different++;
+		if (results[i].population == seeds)
+			unchanged++;
+		for (int j = 0; j < i; j += 2)
+			if (results[j].population == results[i].population)
+			{
+				repeated++;
+				break;
+			}
+		cerr << "worker " << i << ": " << results[i].mutations << " mutations, " << results[i].crossovers << " crossovers" << endl;
+	}
+	cout << "workers with results different when run alone: " << different << endl;
+	cout << "workers with the population not changed: " << unchanged << endl;
+	cout << "workers with the same population as another worker: " << repeated << endl;
+	cout << "FINISHED";
+	return different + unchanged + repeated > 0 ? 2 : 0;
+}
@@ -0,0 +1,296 @@
+// This file is a part of Framsticks SDK.  http://www.framsticks.com/
+// Copyright (C) 2019-2020  Maciej Komosinski and Szymon Ulatowski.
+// See LICENSE.txt for details.
+
+#include "fS_archive.h"
+#include "fS_binary.h"
+#include <filesystem>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const int ARCHIVE_HEADER_SIZE = sizeof(ARCHIVE_DATA_MAGIC);
+/// The length, kind, fitness, two parents and the length of the format
+const int RECORD_HEADER_SIZE = 4 + 1 + 8 + 2 * 8 + 1;
+const int RECORD_FITNESS_OFFSET = 5;
+
+template<typename T>
+static void appendValue(string &buffer, T value)
+{
+	buffer.append((const char *) &value, sizeof(value));
+}
+
+template<typename T>
+static T readValue(const char *source)
+{
+	T value;
+	memcpy(&value, source, sizeof(value));
+	return value;
+}
+
+static string getIndexPath(const char *path)
+{
+	return string(path) + ARCHIVE_INDEX_SUFFIX;
+}
+
+/// Check the header of an archive file that is already open; an empty file gets the header
+static bool prepareHeader(FILE *file, int64_t size, const char *magic)
+{
+	if (size == 0)
+		return fwrite(magic, 1, ARCHIVE_HEADER_SIZE, file) == size_t(ARCHIVE_HEADER_SIZE);
+	char header[ARCHIVE_HEADER_SIZE];
+	return size >= ARCHIVE_HEADER_SIZE && fseek(file, 0, SEEK_SET) == 0
+		   && fread(header, 1, ARCHIVE_HEADER_SIZE, file) == size_t(ARCHIVE_HEADER_SIZE)
+		   && memcmp(header, magic, ARCHIVE_HEADER_SIZE) == 0;
+}
+
+bool fS_ArchiveWriter::open(const char *path, bool append)
+{
+	close();
+	string indexPath = getIndexPath(path);
+	std::error_code error;
+	int64_t existingDataSize = 0, existingIndexSize = 0;
+	if (append && std::filesystem::exists(path, error))
+	{
+		existingDataSize = std::filesystem::file_size(path, error);
+		existingIndexSize = std::filesystem::exists(indexPath, error) ? std::filesystem::file_size(indexPath, error) : 0;
+		// Records can not be found without the index
+		if (error || (existingDataSize > ARCHIVE_HEADER_SIZE && existingIndexSize == 0))
+			return false;
+	}
+
+	dataFile = fopen(path, existingDataSize > 0 ? "r+b" : "w+b");
+	indexFile = fopen(indexPath.c_str(), existingIndexSize > 0 ? "r+b" : "w+b");
+	if (dataFile == nullptr || indexFile == nullptr || !prepareHeader(dataFile, existingDataSize, ARCHIVE_DATA_MAGIC)
+		|| !prepareHeader(indexFile, existingIndexSize, ARCHIVE_INDEX_MAGIC))
+	{
+		close();
+		return false;
+	}
+
+	// The records that were not completely written by an interrupted run are dropped
+	recordCount = std::max(existingIndexSize - ARCHIVE_HEADER_SIZE, int64_t(0)) / 8;
+	dataSize = ARCHIVE_HEADER_SIZE;
+	for (; recordCount > 0; recordCount--)
+	{
+		char entry[8], length[4];
+		if (fseek(indexFile, ARCHIVE_HEADER_SIZE + (recordCount - 1) * 8, SEEK_SET) != 0 || fread(entry, 1, 8, indexFile) != 8)
+			continue;
+		int64_t offset = readValue<int64_t>(entry);
+		if (offset < ARCHIVE_HEADER_SIZE || offset + RECORD_HEADER_SIZE > existingDataSize || fseek(dataFile, offset, SEEK_SET) != 0
+			|| fread(length, 1, 4, dataFile) != 4 || offset + 4 + readValue<uint32_t>(length) > existingDataSize)
+			continue;
+		dataSize = offset + 4 + readValue<uint32_t>(length);
+		break;
+	}
+	fflush(dataFile);
+	fflush(indexFile);
+	std::filesystem::resize_file(path, dataSize, error);
+	if (!error)
+		std::filesystem::resize_file(indexPath, ARCHIVE_HEADER_SIZE + recordCount * 8, error);
+	if (error || fseek(dataFile, 0, SEEK_END) != 0 || fseek(indexFile, 0, SEEK_END) != 0)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void fS_ArchiveWriter::flush()
+{
+	if (dataFile != nullptr)
+		fflush(dataFile);
+	if (indexFile != nullptr)
+		fflush(indexFile);
+}
+
+void fS_ArchiveWriter::close()
+{
+	flush();
+	if (dataFile != nullptr)
+		fclose(dataFile);
+	if (indexFile != nullptr)
+		fclose(indexFile);
+	dataFile = indexFile = nullptr;
+	dataSize = recordCount = 0;
+}
+
+int64_t fS_ArchiveWriter::addRecord(fS_ArchiveEntry::Kind kind, double fitness, int64_t parent1, int64_t parent2,
+		const char *format, int formatLength, const char *genotype, int genotypeLength)
+{
+	if (dataFile == nullptr)
+		throw fS_Exception("Archive is not open", 0);
+	if (formatLength > 255)
+		throw fS_Exception("Genetic format name is too long", 0);
+
+	buffer.clear();
+	appendValue(buffer, uint32_t(RECORD_HEADER_SIZE - 4 + formatLength + genotypeLength));
+	appendValue(buffer, uint8_t(kind));
+	appendValue(buffer, fitness);
+	appendValue(buffer, parent1);
+	appendValue(buffer, parent2);
+	appendValue(buffer, uint8_t(formatLength));
+	buffer.append(format, formatLength);
+	buffer.append(genotype, genotypeLength);
+
+	int64_t offset = dataSize;
+	if (fwrite(buffer.c_str(), 1, buffer.size(), dataFile) != buffer.size() || fwrite(&offset, 1, 8, indexFile) != 8)
+		throw fS_Exception("Could not write the archive", 0);
+	dataSize += buffer.size();
+	return recordCount++;
+}
+
+int64_t fS_ArchiveWriter::add(fS_Genotype &genotype, double fitness, int64_t parent1, int64_t parent2)
+{
+	string binary;
+	fS_BinaryCodec::encode(genotype, binary);
+	return addRecord(fS_ArchiveEntry::BINARY_FS, fitness, parent1, parent2, "S", 1, binary.c_str(), int(binary.length()));
+}
+
+int64_t fS_ArchiveWriter::add(const SString &genes, const SString &format, double fitness, int64_t parent1, int64_t parent2)
+{
+	return addRecord(fS_ArchiveEntry::TEXT, fitness, parent1, parent2, format.c_str(), format.length(), genes.c_str(), genes.length());
+}
+
+const char *fS_ArchiveReader::mapFile(const char *path, int64_t &size, bool &ok)
+{
+	size = 0;
+	ok = false;
+#ifdef _WIN32
+	// Without mmap, the file is read into memory
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return nullptr;
+	size = file.tellg();
+	char *mapping = size > 0 ? new char[size] : nullptr;
+	file.seekg(0);
+	if (size > 0 && !file.read(mapping, size))
+	{
+		delete[] mapping;
+		size = 0;
+		return nullptr;
+	}
+	ok = true;
+	return mapping;
+#else
+	int descriptor = ::open(path, O_RDONLY);
+	if (descriptor < 0)
+		return nullptr;
+	struct stat status;
+	if (fstat(descriptor, &status) != 0)
+	{
+		::close(descriptor);
+		return nullptr;
+	}
+	size = status.st_size;
+	void *mapping = nullptr;
+	if (size > 0)
+	{
+		mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+		if (mapping == MAP_FAILED)
+		{
+			::close(descriptor);
+			size = 0;
+			return nullptr;
+		}
+	}
+	::close(descriptor);	// The mapping stays valid after the file is closed
+	ok = true;
+	return (const char *) mapping;
+#endif
+}
+
+void fS_ArchiveReader::unmapFile(const char *mapping, int64_t size)
+{
+	if (mapping == nullptr)
+		return;
+#ifdef _WIN32
+	delete[] mapping;
+#else
+	munmap((void *) mapping, size);
+#endif
+}
+
+bool fS_ArchiveReader::open(const char *path)
+{
+	close();
+	bool dataOk, indexOk;
+	data = mapFile(path, dataSize, dataOk);
+	index = mapFile(getIndexPath(path).c_str(), indexSize, indexOk);
+	if (!dataOk || !indexOk || dataSize < ARCHIVE_HEADER_SIZE || indexSize < ARCHIVE_HEADER_SIZE
+		|| memcmp(data, ARCHIVE_DATA_MAGIC, ARCHIVE_HEADER_SIZE) != 0 || memcmp(index, ARCHIVE_INDEX_MAGIC, ARCHIVE_HEADER_SIZE) != 0)
+	{
+		close();
+		return false;
+	}
+	recordCount = (indexSize - ARCHIVE_HEADER_SIZE) / 8;
+	return true;
+}
+
+void fS_ArchiveReader::close()
+{
+	unmapFile(data, dataSize);
+	unmapFile(index, indexSize);
+	data = index = nullptr;
+	dataSize = indexSize = recordCount = 0;
+}
+
+const char *fS_ArchiveReader::getRecord(int64_t recordIndex) const
+{
+	if (recordIndex < 0 || recordIndex >= recordCount)
+		throw fS_Exception("Archive record index out of range", 0);
+	int64_t offset = readValue<int64_t>(index + ARCHIVE_HEADER_SIZE + recordIndex * 8);
+	if (offset < ARCHIVE_HEADER_SIZE || offset > dataSize - RECORD_HEADER_SIZE)
+		throw fS_Exception("Damaged archive record", 0);
+	return data + offset;
+}
+
+double fS_ArchiveReader::getFitness(int64_t recordIndex) const
+{
+	return readValue<double>(getRecord(recordIndex) + RECORD_FITNESS_OFFSET);
+}
+
+fS_ArchiveEntry fS_ArchiveReader::get(int64_t recordIndex) const
+{
+	const char *record = getRecord(recordIndex);
+	int64_t length = readValue<uint32_t>(record);
+	uint8_t kind = readValue<uint8_t>(record + 4);
+	uint8_t formatLength = readValue<uint8_t>(record + RECORD_HEADER_SIZE - 1);
+	if (record - data + 4 + length > dataSize || length < RECORD_HEADER_SIZE - 4 + formatLength || kind > fS_ArchiveEntry::TEXT)
+		throw fS_Exception("Damaged archive record", 0);
+
+	fS_ArchiveEntry entry;
+	entry.kind = fS_ArchiveEntry::Kind(kind);
+	entry.fitness = readValue<double>(record + RECORD_FITNESS_OFFSET);
+	entry.parents[0] = readValue<int64_t>(record + RECORD_FITNESS_OFFSET + 8);
+	entry.parents[1] = readValue<int64_t>(record + RECORD_FITNESS_OFFSET + 16);
+	entry.format = record + RECORD_HEADER_SIZE;
+	entry.formatLength = formatLength;
+	entry.genotype = entry.format + formatLength;
+	entry.genotypeLength = int(4 + length - RECORD_HEADER_SIZE - formatLength);
+	return entry;
+}
+
+SString fS_ArchiveReader::getGenes(const fS_ArchiveEntry &entry) const
+{
+	if (entry.kind == fS_ArchiveEntry::TEXT)
+		return SString(entry.genotype, entry.genotypeLength);
+	fS_Genotype *genotype = fS_BinaryCodec::decode(entry.genotype, entry.genotypeLength);
+	SString result = genotype->getGeno();
+	delete genotype;
+	return result;
+}
+
+fS_Genotype *fS_ArchiveReader::getGenotype(const fS_ArchiveEntry &entry) const
+{
+	if (entry.kind == fS_ArchiveEntry::BINARY_FS)
+		return fS_BinaryCodec::decode(entry.genotype, entry.genotypeLength);
+	if (entry.formatLength != 1 || entry.format[0] != 'S')
+		throw fS_Exception("Archive record is not an fS genotype", 0);
+	return new fS_Genotype(string(entry.genotype, entry.genotypeLength));
+}
@@ -0,0 +1,152 @@
+// This file is a part of Framsticks SDK.  http://www.framsticks.com/
+// Copyright (C) 2019-2020  Maciej Komosinski and Szymon Ulatowski.
+// See LICENSE.txt for details.
+
+#ifndef _FS_ARCHIVE_H_
+#define _FS_ARCHIVE_H_
+
+#include <stdio.h>
+#include "fS_general.h"
+
+/**
+ * The archive of evaluated individuals: their genotypes, fitness and parents
+ *
+ * An archive consists of two append-only files:
+ *  - the data file, with a header followed by records. A record is its length (uint32), its kind (uint8),
+ *    the fitness (double), the indices of two parents in the archive (int64, -1 if there is no parent)
+ *    and the genotype: the binary form of fS_BinaryCodec, or a text genotype of another format.
+ *  - the index file (the data file name with ".idx" appended), with a header followed by the offset
+ *    of every record in the data file (uint64). An individual is identified by the index of its record.
+ * If a run is interrupted, the index may list records that were not completely written. Readers check every record
+ * against the size of the data file, and opening the archive for appending drops such records.
+ * Numbers are stored in the byte order of the machine, which must be little-endian for archives to be portable.
+ */
+
+const char ARCHIVE_DATA_MAGIC[8] = {'f', 'S', 'a', 'r', 'c', 'h', 0, 1};
+const char ARCHIVE_INDEX_MAGIC[8] = {'f', 'S', 'i', 'n', 'd', 'x', 0, 1};
+const char *const ARCHIVE_INDEX_SUFFIX = ".idx";
+
+/**
+ * A record of the archive, as seen by fS_ArchiveReader
+ * The genotype points into the mapped file and is valid until the reader is closed.
+ */
+struct fS_ArchiveEntry
+{
+	enum Kind { BINARY_FS = 0, TEXT = 1 };
+
+	Kind kind;
+	double fitness;
+	int64_t parents[2];	/// The indices of the parents in the archive, or -1
+	const char *format;	/// The genetic format, "S" for BINARY_FS
+	int formatLength;
+	const char *genotype;	/// The binary form of fS genotype for BINARY_FS, or the genes for TEXT
+	int genotypeLength;
+};
+
+/**
+ * Appends individuals to an archive
+ * Writing is buffered; the records are visible to readers after flush() or close().
+ */
+class fS_ArchiveWriter
+{
+	FILE *dataFile = nullptr;
+	FILE *indexFile = nullptr;
+	int64_t dataSize = 0;	/// The offset at which the next record is written
+	int64_t recordCount = 0;
+	string buffer;	/// The record that is being written, reused between records
+
+	int64_t addRecord(fS_ArchiveEntry::Kind kind, double fitness, int64_t parent1, int64_t parent2, const char *format,
+			int formatLength, const char *genotype, int genotypeLength);
+
+public:
+	~fS_ArchiveWriter() { close(); }
+
+	/**
+	 * Open the archive for writing
+	 * @param path the path of the data file
+	 * @param append if true, new records are added after the records that are already in the archive;
+	 * if false, the archive is created anew
+	 * @return false if the files could not be opened or are not an archive
+	 */
+	bool open(const char *path, bool append = false);
+
+	void flush();
+
+	void close();
+
+	/// Get the number of records in the archive, which is also the index of the next record
+	int64_t getRecordCount() const { return recordCount; }
+
+	/**
+	 * Add an fS individual in the binary form
+	 * @param parent1, parent2 the indices of the parents in the archive, or -1
+	 * @return the index of the record
+	 */
+	int64_t add(fS_Genotype &genotype, double fitness, int64_t parent1 = -1, int64_t parent2 = -1);
+
+	/**
+	 * Add an individual of any format in the text form
+	 * @return the index of the record
+	 */
+	int64_t add(const SString &genes, const SString &format, double fitness, int64_t parent1 = -1, int64_t parent2 = -1);
+};
+
+/**
+ * Reads an archive without loading it into memory
+ * The files are mapped into memory, so records are read on demand, and any record can be reached directly through the index.
+ * The records that are appended after opening are not seen until the archive is opened again.
+ */
+class fS_ArchiveReader
+{
+	const char *data = nullptr;
+	int64_t dataSize = 0;
+	const char *index = nullptr;
+	int64_t indexSize = 0;
+	int64_t recordCount = 0;
+
+	/// Map the whole file into memory; the size of an empty file is 0 and the result is null
+	static const char *mapFile(const char *path, int64_t &size, bool &ok);
+
+	static void unmapFile(const char *mapping, int64_t size);
+
+	/// Get the beginning of the record, checking that its fixed-size part is in the data file
+	const char *getRecord(int64_t recordIndex) const;
+
+public:
+	~fS_ArchiveReader() { close(); }
+
+	/**
+	 * Open the archive for reading
+	 * @param path the path of the data file
+	 * @return false if the files could not be opened or are not an archive
+	 */
+	bool open(const char *path);
+
+	void close();
+
+	int64_t getRecordCount() const { return recordCount; }
+
+	/**
+	 * Get the record with the given index
+	 * @throws fS_Exception if the index is out of range or the record is damaged
+	 */
+	fS_ArchiveEntry get(int64_t recordIndex) const;
+
+	/// Get the fitness of the record without reading the rest of it
+	double getFitness(int64_t recordIndex) const;
+
+	/**
+	 * Get the genes of the record; fS genotypes are decoded and written as text
+	 * @throws fS_Exception if the record is damaged
+	 */
+	SString getGenes(const fS_ArchiveEntry &entry) const;
+
+	/**
+	 * Decode the fS genotype of the record
+	 * @return the new genotype, which the caller must delete
+	 * @throws fS_Exception if the record does not hold a valid fS genotype
+	 */
+	fS_Genotype *getGenotype(const fS_ArchiveEntry &entry) const;
+};
+
+#endif
@@ -0,0 +1,480 @@
+// This file is a part of Framsticks SDK.  http://www.framsticks.com/
+// Copyright (C) 2019-2020  Maciej Komosinski and Szymon Ulatowski.
+// See LICENSE.txt for details.
+
+#include "fS_binary.h"
+
+const char BINARY_MAGIC[] = {'f', 'S'};
+const int MAX_BINARY_PRECISION = 22;	/// Powers of 10 up to this one are exact doubles
+const double POWERS_OF_10[MAX_BINARY_PRECISION + 1] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+const string SHAPE_GENES {ELLIPSOID, CUBOID, CYLINDER};	/// The order of part types in the node byte
+
+// The node byte: 2 bits of the part type, 2 bits of the joint and the flags of the sections that follow
+const unsigned char SHAPE_MASK = 0x03;
+const int JOINT_SHIFT = 2;
+const unsigned char JOINT_MASK = 0x0c;
+const unsigned char HAS_MODIFIERS = 0x10;
+const unsigned char HAS_NEURONS = 0x20;
+const unsigned char HAS_PARAMS = 0x40;
+const unsigned char HAS_CHILDREN = 0x80;
+
+const unsigned char TURN_WITH_ROTATION = 0x01;	/// The flag of the genotype params byte
+
+struct fS_BinaryCodec::Writer
+{
+	string &result;
+	int precision;
+	double quantum;
+	bool exactValues;
+	vector<int> neuronPositions;	/// Positions of neurons by their identifiers
+	vector<int> detailIds;	/// Indices of the details of neurons in the table, by the positions of neurons
+	int neuronIndex = 0;	/// The position of the next neuron to write
+
+	Writer(string &_result, int _precision, bool _exactValues) : result(_result), precision(_precision), exactValues(_exactValues)
+	{
+		quantum = POWERS_OF_10[precision];
+	}
+
+	void writeVarint(uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			result.push_back(char(value | 0x80));
+			value >>= 7;
+		}
+		result.push_back(char(value));
+	}
+
+	/// Zigzag encoding, so that small negative numbers are short too
+	void writeSigned(int64_t value)
+	{
+		writeVarint((uint64_t(value) << 1) ^ uint64_t(value >> 63));
+	}
+
+	void writeString(const char *str, int length)
+	{
+		writeVarint(length);
+		result.append(str, length);
+	}
+
+	/**
+	 * Write a multiple of 10^-precision
+	 * The trailing zeros of the multiple are not written; the number of the decimal digits that are left is written instead.
+	 * The lowest bit of the first number tells if a multiple or an exact double follows.
+	 */
+	void writeMultiple(int64_t multiple)
+	{
+		int digits = precision;
+		while (digits > 0 && multiple % 10 == 0)
+		{
+			multiple /= 10;
+			digits--;
+		}
+		uint64_t zigzag = (uint64_t(multiple) << 1) ^ uint64_t(multiple >> 63);
+		writeVarint((zigzag * (precision + 1) + digits) << 1);
+	}
+
+	void writeDouble(double value)
+	{
+		writeVarint(1);
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		for (int i = 0; i < 8; i++)
+			result.push_back(char(bits >> (8 * i)));
+	}
+
+	/// Write the value as a multiple of 10^-precision if this is exact, or as an exact double otherwise
+	void writeExact(double value)
+	{
+		double scaled = value * quantum;
+		if (fabs(scaled) < MAX_QUANTIZED)
+		{
+			int64_t multiple = llround(scaled);
+			double restored = multiple / quantum;
+			// Bits are compared, so that the sign of zero is kept too
+			if (memcmp(&restored, &value, sizeof(value)) == 0)
+			{
+				writeMultiple(multiple);
+				return;
+			}
+		}
+		writeDouble(value);
+	}
+
+	/**
+	 * Write the value that is written in the text form with fS_GenoWriter::writeFixed()
+	 * Unless exactValues is set, the value is rounded to the same decimal digits as in the text form,
+	 * so the decoded value is equal to the one parsed from text.
+	 */
+	void writeFixed(double value)
+	{
+		int64_t multiple;
+		if (exactValues || !fS_quantizeFixed(value, precision, quantum, multiple))
+		{
+			writeExact(value);
+			return;
+		}
+		if (multiple == 0 && std::signbit(value))
+			writeDouble(-0.0);	// Written as "-0" in text
+		else
+			writeMultiple(multiple);
+	}
+};
+
+struct fS_BinaryCodec::Reader
+{
+	const unsigned char *data;
+	int length;
+	int position = 0;
+	int precision = 0;
+
+	Reader(const char *_data, int _length) : data((const unsigned char *) _data), length(_length)
+	{}
+
+	[[noreturn]] void fail(int errorPosition)
+	{
+		throw fS_Exception("Invalid binary genotype", errorPosition);
+	}
+
+	unsigned char readByte()
+	{
+		if (position >= length)
+			fail(position);
+		return data[position++];
+	}
+
+	uint64_t readVarint()
+	{
+		int start = position;
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			unsigned char byte = readByte();
+			value |= uint64_t(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				return value;
+		}
+		fail(start);
+	}
+
+	/// Read a non-negative number that must be less than the limit
+	int readCount(int limit)
+	{
+		int start = position;
+		uint64_t value = readVarint();
+		if (value >= uint64_t(limit))
+			fail(start);
+		return int(value);
+	}
+
+	int64_t readSigned()
+	{
+		uint64_t value = readVarint();
+		return int64_t(value >> 1) ^ -int64_t(value & 1);
+	}
+
+	double readValue()
+	{
+		uint64_t tag = readVarint();
+		if ((tag & 1) == 0)
+		{
+			// The same multiple with fewer digits gives the same double, as both divisions are exact up to rounding
+			tag >>= 1;
+			int digits = int(tag % (precision + 1));
+			uint64_t zigzag = tag / (precision + 1);
+			int64_t multiple = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+			return multiple / POWERS_OF_10[digits];
+		}
+		if (tag != 1 || length - position < 8)
+			fail(position);
+		uint64_t bits = 0;
+		for (int i = 0; i < 8; i++)
+			bits |= uint64_t(data[position++]) << (8 * i);
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	SString readString()
+	{
+		int size = readCount(length - position + 1);
+		SString result((const char *) data + position, size);
+		position += size;
+		return result;
+	}
+};
+
+void fS_BinaryCodec::writeNode(Writer &writer, Node *node)
+{
+	bool hasModifiers = false;
+	for (auto it = node->modifiers.begin(); it != node->modifiers.end(); ++it)
+		hasModifiers |= it->second != 0;
+
+	unsigned char flags = (unsigned char) (SHAPE_GENES.find(SHAPE_TO_GENE.at(node->partShape)) | ALL_JOINTS.find(node->joint) << JOINT_SHIFT);
+	if (hasModifiers)
+		flags |= HAS_MODIFIERS;
+	if (!node->neurons.empty())
+		flags |= HAS_NEURONS;
+	if (!node->params.empty())
+		flags |= HAS_PARAMS;
+	if (!node->children.empty())
+		flags |= HAS_CHILDREN;
+	writer.result.push_back(char(flags));
+
+	if (hasModifiers)
+	{
+		for (int i = 0; i < int(MODIFIERS.length()); i++)
+		{
+			auto it = node->modifiers.find(MODIFIERS[i]);
+			writer.writeSigned(it != node->modifiers.end() ? it->second : 0);
+		}
+	}
+
+	if (!node->neurons.empty())
+	{
+		writer.writeVarint(node->neurons.size());
+		for (int i = 0; i < int(node->neurons.size()); i++)
+		{
+			fS_Neuron *neuron = node->neurons[i];
+			writer.writeVarint(writer.detailIds[writer.neuronIndex++]);
+
+			// Inputs are sorted by positions and each position is written as the difference from the previous one
+			vector<std::pair<int, double>> inputs;
+			for (auto it = neuron->inputs.begin(); it != neuron->inputs.end(); ++it)
+			{
+				if (it->first < 0 || it->first >= int(writer.neuronPositions.size()) || writer.neuronPositions[it->first] == -1)
+					throw fS_Exception("Internal error: connection to a neuron that is not in genotype", 0);
+				inputs.push_back({writer.neuronPositions[it->first], it->second});
+			}
+			std::sort(inputs.begin(), inputs.end());
+			writer.writeVarint(inputs.size());
+			int previous = 0;
+			for (int k = 0; k < int(inputs.size()); k++)
+			{
+				// The lowest bit tells if the weight differs from the default one and follows
+				bool hasWeight = inputs[k].second != DEFAULT_NEURO_CONNECTION_WEIGHT;
+				writer.writeVarint(uint64_t(inputs[k].first - previous) << 1 | (hasWeight ? 1 : 0));
+				// Weights are written in text with all their digits, so they are always kept exactly
+				if (hasWeight)
+					writer.writeExact(inputs[k].second);
+				previous = inputs[k].first;
+			}
+		}
+	}
+
+	if (!node->params.empty())
+	{
+		unsigned int mask = 0;
+		for (auto it = node->params.begin(); it != node->params.end(); ++it)
+		{
+			auto key = std::find(PARAMS.begin(), PARAMS.end(), it->first);
+			if (key == PARAMS.end())
+				throw fS_Exception("Invalid parameter key", 0);
+			mask |= 1u << (key - PARAMS.begin());
+		}
+		writer.writeVarint(mask);
+		for (int i = 0; i < int(PARAMS.size()); i++)
+		{
+			if (mask & (1u << i))
+				writer.writeFixed(node->params[PARAMS[i]]);
+		}
+	}
+
+	if (!node->children.empty())
+	{
+		writer.writeVarint(node->children.size());
+		for (int i = 0; i < int(node->children.size()); i++)
+			writeNode(writer, node->children[i]);
+	}
+}
+
+void fS_BinaryCodec::encode(fS_Genotype &genotype, string &result, bool exactValues)
+{
+	int precision = fS_Genotype::precision;
+	if (precision < 0 || precision > MAX_BINARY_PRECISION)
+	{
+		// Values can not be quantized like in the text form
+		precision = 0;
+		exactValues = true;
+	}
+	Writer writer(result, precision, exactValues);
+
+	result.append(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+	result.push_back(char(VERSION));
+	result.push_back(char(precision));
+
+	GenotypeParams &genotypeParams = genotype.startNode->genotypeParams;
+	result.push_back(char(genotypeParams.turnWithRotation ? TURN_WITH_ROTATION : 0));
+	writer.writeFixed(genotypeParams.modifierMultiplier);
+	writer.writeFixed(genotypeParams.paramMutationStrength);
+
+	// Every distinct neuron details are written once, in the order of their first use
+	vector<fS_Neuron *> allNeurons = genotype.getAllNeurons();
+	writer.detailIds.resize(allNeurons.size());
+	vector<SString> details;
+	std::map<string, int> detailIndices;
+	for (int i = 0; i < int(allNeurons.size()); i++)
+	{
+		SString neuronDetails = allNeurons[i]->getDetails();
+		auto inserted = detailIndices.insert({string(neuronDetails.c_str(), neuronDetails.length()), int(details.size())});
+		if (inserted.second)
+			details.push_back(neuronDetails);
+		writer.detailIds[i] = inserted.first->second;
+	}
+	writer.writeVarint(details.size());
+	for (int i = 0; i < int(details.size()); i++)
+		writer.writeString(details[i].c_str(), details[i].length());
+
+	writer.neuronPositions = genotype.getNeuronPositions();
+	writeNode(writer, genotype.startNode);
+}
+
+Node *fS_BinaryCodec::readNode(Reader &reader, Node *parent, const GenotypeParams &genotypeParams, const vector<SString> &details)
+{
+	int flagsPosition = reader.position;
+	unsigned char flags = reader.readByte();
+	int shapeIndex = flags & SHAPE_MASK;
+	int jointIndex = (flags & JOINT_MASK) >> JOINT_SHIFT;
+	if (shapeIndex >= int(SHAPE_GENES.length()) || jointIndex >= int(ALL_JOINTS.length()))
+		reader.fail(flagsPosition);
+
+	Node *node = new Node(parent, genotypeParams);
+	try
+	{
+		node->partShape = GENE_TO_SHAPE.at(SHAPE_GENES[shapeIndex]);
+		node->joint = ALL_JOINTS[jointIndex];
+
+		if (flags & HAS_MODIFIERS)
+		{
+			for (int i = 0; i < int(MODIFIERS.length()); i++)
+			{
+				int start = reader.position;
+				int64_t count = reader.readSigned();
+				if (count < INT_MIN || count > INT_MAX)
+					reader.fail(start);
+				if (count != 0)
+					node->modifiers[MODIFIERS[i]] = int(count);
+			}
+		}
+
+		if (flags & HAS_NEURONS)
+		{
+			int neuronCount = reader.readCount(INT_MAX);
+			for (int i = 0; i < neuronCount; i++)
+			{
+				fS_Neuron *neuron = new fS_Neuron("", 0, 0);
+				node->neurons.push_back(neuron);
+				int detailsPosition = reader.position;
+				const SString &neuronDetails = details[reader.readCount(int(details.size()))];
+				// The class is checked like in the text form, where an unknown name is not a neuron class
+				const char *nameEnd = strchr(neuronDetails.c_str(), ':');
+				int nameLength = nameEnd != nullptr ? int(nameEnd - neuronDetails.c_str()) : neuronDetails.length();
+				if (findNeuroClass(neuronDetails.c_str(), nameLength, true) == nullptr)
+					reader.fail(detailsPosition);
+				neuron->setDetails(neuronDetails);
+
+				// Inputs are read as positions, like in the text form
+				int inputCount = reader.readCount(INT_MAX);
+				int64_t position = 0;
+				for (int k = 0; k < inputCount; k++)
+				{
+					int start = reader.position;
+					uint64_t input = reader.readVarint();
+					// Positions are increasing, so only the first difference may be zero
+					if ((input >> 1) > uint64_t(INT_MAX) || (k > 0 && (input >> 1) == 0))
+						reader.fail(start);
+					position += int64_t(input >> 1);
+					if (position > INT_MAX)
+						reader.fail(start);
+					double weight = (input & 1) ? reader.readValue() : DEFAULT_NEURO_CONNECTION_WEIGHT;
+					neuron->inputs.set(int(position), weight);
+				}
+			}
+		}
+
+		if (flags & HAS_PARAMS)
+		{
+			int maskPosition = reader.position;
+			int mask = reader.readCount(1 << PARAMS.size());
+			if (mask == 0)
+				reader.fail(maskPosition);
+			for (int i = 0; i < int(PARAMS.size()); i++)
+			{
+				if ((mask & (1 << i)) == 0)
+					continue;
+				int start = reader.position;
+				double value = reader.readValue();
+				const string &key = PARAMS[i];
+				if ((key == SCALE_X || key == SCALE_Y || key == SCALE_Z) && !(value > 0.0))
+					reader.fail(start);
+				node->params[key] = value;
+			}
+		}
+
+		if (flags & HAS_CHILDREN)
+		{
+			int childCount = reader.readCount(INT_MAX);
+			for (int i = 0; i < childCount; i++)
+			{
+				Node *child = readNode(reader, node, genotypeParams, details);
+				node->children.push_back(child);
+				node->subtreeSize += child->subtreeSize;
+			}
+		}
+	}
+	catch (fS_Exception &e)
+	{
+		delete node;
+		throw e;
+	}
+	return node;
+}
+
+fS_Genotype *fS_BinaryCodec::decode(const char *data, int length)
+{
+	Reader reader(data, length);
+	for (int i = 0; i < int(sizeof(BINARY_MAGIC)); i++)
+	{
+		if (reader.readByte() != (unsigned char) BINARY_MAGIC[i])
+			throw fS_Exception("Not a binary fS genotype", 0);
+	}
+	if (reader.readByte() != VERSION)
+		throw fS_Exception("Unsupported version of binary fS genotype", reader.position - 1);
+	reader.precision = reader.readByte();
+	if (reader.precision > MAX_BINARY_PRECISION)
+		reader.fail(reader.position - 1);
+
+	GenotypeParams genotypeParams = fS_Genotype::getDefaultGenotypeParams();
+	unsigned char paramFlags = reader.readByte();
+	if (paramFlags & ~TURN_WITH_ROTATION)
+		reader.fail(reader.position - 1);
+	genotypeParams.turnWithRotation = (paramFlags & TURN_WITH_ROTATION) != 0;
+	genotypeParams.modifierMultiplier = reader.readValue();
+	genotypeParams.paramMutationStrength = reader.readValue();
+
+	int detailCount = reader.readCount(length - reader.position + 1);
+	vector<SString> details(detailCount);
+	for (int i = 0; i < detailCount; i++)
+		details[i] = reader.readString();
+
+	fS_Genotype *genotype = new fS_Genotype();
+	try
+	{
+		genotype->startNode = readNode(reader, nullptr, genotypeParams, details);
+		if (reader.position != length)
+			reader.fail(reader.position);
+		genotype->validateNeuroInputs();
+
+		// Neuron inputs are read as positions, so the initial identifiers are equal to positions
+		vector<fS_Neuron *> allNeurons = genotype->getAllNeurons();
+		for (int i = 0; i < int(allNeurons.size()); i++)
+			genotype->assignNeuronId(allNeurons[i]);
+	}
+	catch (fS_Exception &e)
+	{
+		delete genotype;
+		throw e;
+	}
+	return genotype;
+}
@@ -0,0 +1,61 @@
+// This file is a part of Framsticks SDK.  http://www.framsticks.com/
+// Copyright (C) 2019-2020  Maciej Komosinski and Szymon Ulatowski.
+// See LICENSE.txt for details.
+
+#ifndef _FS_BINARY_H_
+#define _FS_BINARY_H_
+
+#include "fS_general.h"
+
+/**
+ * Converts fS genotypes to a compact binary form and back
+ *
+ * The binary form is lossless with respect to the text form: fS_Genotype::getGeno() gives the same text
+ * for the encoded and the decoded genotype. Params are rounded like in the text form, unless exact values are requested;
+ * neuron weights are always kept exactly, as the text form writes all their digits.
+ * The layout is:
+ *  - the magic bytes 'f', 'S', the format version and the precision that the values were quantized with,
+ *  - the genotype params,
+ *  - the table of distinct neuron details; neurons refer to their details by the index in this table,
+ *  - the nodes in pre-order. Every node starts with a byte that packs the part type, the joint
+ *    and the flags of the optional sections that follow: modifier counts, neurons, params and the child count.
+ *    Params are stored as a bitmask of the keys from PARAMS followed by the values of the keys that are present.
+ * Integers are stored as variable-length numbers. A value that is a whole multiple of 10^-precision
+ * is stored as that multiple, every other value as an exact double.
+ * Decoding builds the node tree directly; the decoded genotype has no text, so its model mappings are empty.
+ */
+class fS_BinaryCodec
+{
+	struct Writer;	/// Writes the binary form and keeps the neuron tables of the genotype
+	struct Reader;	/// Reads the binary form with bounds checking
+
+	/// Write the subtree that starts in the node
+	static void writeNode(Writer &writer, Node *node);
+
+	/// Read the subtree that starts at the current position of the reader
+	static Node *readNode(Reader &reader, Node *parent, const GenotypeParams &genotypeParams, const vector<SString> &details);
+
+public:
+	static const unsigned char VERSION = 1;
+
+	/**
+	 * Append the binary form of the genotype
+	 * @param genotype the genotype; its neuron identifiers are not changed
+	 * @param result the string that the binary form is appended to
+	 * @param exactValues if false, params are rounded to fS_Genotype::precision decimal places, like in the text form,
+	 * and the decoded genotype is equal to the one parsed from fS_Genotype::getGeno(); if true, all values are kept exactly
+	 * @throws fS_Exception if a node has a param that is not in PARAMS
+	 */
+	static void encode(fS_Genotype &genotype, string &result, bool exactValues = false);
+
+	/**
+	 * Build a genotype from its binary form
+	 * @param data the binary form, as written by encode()
+	 * @param length the number of bytes of data
+	 * @return the new genotype, which the caller must delete
+	 * @throws fS_Exception with the offset of the invalid byte if the data is not a valid binary genotype
+	 */
+	static fS_Genotype *decode(const char *data, int length);
+};
+
+#endif
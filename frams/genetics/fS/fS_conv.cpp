@@ -6,24 +6,45 @@
 
 SString GenoConv_fS0s::convert(SString &i, MultiMap *map, bool using_checkpoints)
 {
-	fS_Genotype *genotype;
+	Model model;
+	if (!buildModel(i, model, map, using_checkpoints, conversionTimes))
+		return SString();
+	if (conversionTimes == nullptr)
+		return model.getF0Geno().getGenes();
+
+	auto start = std::chrono::steady_clock::now();
+	SString f0 = model.getF0Geno().getGenes();
+	conversionTimes->f0 += fS_elapsedNanoseconds(start);
+	return f0;
+}
+
+bool GenoConv_fS0s::buildModel(const SString &genotype, Model &model, MultiMap *map, bool using_checkpoints,
+		fS_ConversionTimes *times)
+{
+	fS_Genotype *fsGenotype;
 	try
 	{
-		genotype = new fS_Genotype(i.c_str());
+		std::chrono::steady_clock::time_point start;
+		if (times != nullptr)
+			start = std::chrono::steady_clock::now();
+		fsGenotype = new fS_Genotype(genotype.c_str());
+		if (times != nullptr)
+			times->parse += fS_elapsedNanoseconds(start);
 	}
 	catch (fS_Exception &e)
 	{
 		logPrintf("GenoConv_fS0s", "convert", LOG_ERROR, e.what());
-		return SString();
+		model.clear();
+		return false;
 	}
 
-	Model model = genotype->buildModel(using_checkpoints);
-	delete genotype;
+	fsGenotype->conversionTimes = times;
+	fsGenotype->buildModel(model, using_checkpoints, map != nullptr);
+	delete fsGenotype;
 
 	if (map)
 	{
 		model.getCurrentToF0Map(*map);
 	}
-
-	return model.getF0Geno().getGenes();
+	return true;
 }
@@ -23,9 +23,28 @@ public:
 		mapsupport = 1;
 	}
 
-	/// Return empty string if can not convert
+	/**
+	 * Return empty string if can not convert
+	 * With using_checkpoints, the model copies itself after every part, so the time grows with the square of the number
+	 * of parts. Callers that only need some of the checkpoints should build the model with
+	 * fS_Genotype::buildModel(model, developmentLog) and create them with fS_Genotype::buildCheckpoint().
+	 */
 	SString convert(SString &i, MultiMap *map, bool using_checkpoints);
 
+	/**
+	 * Build the model of an fS genotype directly, without the f0 text that convert() produces
+	 * @param genotype in fS format
+	 * @param model the model to build; empty if the genotype is invalid
+	 * @param map if not null, the mapping between the genotype and the model is added to it
+	 * @param times if not null, the time of the conversion stages is added to it
+	 * @return true if the model was built
+	 */
+	static bool buildModel(const SString &genotype, Model &model, MultiMap *map = nullptr, bool using_checkpoints = false,
+			fS_ConversionTimes *times = nullptr);
+
+	/// If not null, convert() adds the time of its stages to it. Give each thread its own converter when measuring.
+	fS_ConversionTimes *conversionTimes = nullptr;
+
 	~GenoConv_fS0s()
 	{};
 };
@@ -3,6 +3,9 @@
 // See LICENSE.txt for details.
 
 #include <float.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include "fS_general.h"
 #include "frams/model/geometry/geometryutils.h"
 #include "frams/genetics/genooperators.h"
@@ -13,14 +16,15 @@
 #include "common/nonstd_math.h"
 #include "part_distance_estimator.h"
 
-int fS_Genotype::precision = 4;
+std::atomic<int> fS_Genotype::precision(4);
 std::map<string, double> Node::minValues;
 std::map<string, double> Node::defaultValues;
 std::map<string, double> Node::maxValues;
 
 void Node::prepareParams()
 {
-	if(minValues.empty())
+	static std::once_flag prepared;
+	std::call_once(prepared, []()
 	{
 		minValues = {
 				{INGESTION, Model::getMinPart().ingest},
@@ -36,10 +40,6 @@ void Node::prepareParams()
 				{SCALE_Y,    Model::getMinPart().scale.y},
 				{SCALE_Z,    Model::getMinPart().scale.z}
 		};
-	}
-
-	if(maxValues.empty())
-	{
 		maxValues = {
 				{INGESTION, Model::getMaxPart().ingest},
 				{FRICTION,  Model::getMaxPart().friction},
@@ -54,9 +54,6 @@ void Node::prepareParams()
 				{SCALE_Y,    Model::getMaxPart().scale.y},
 				{SCALE_Z,    Model::getMaxPart().scale.z}
 		};
-	}
-	if(defaultValues.empty())
-	{
 		defaultValues = {
 				{INGESTION, Model::getDefPart().ingest},
 				{FRICTION,  Model::getDefPart().friction},
@@ -71,7 +68,7 @@ void Node::prepareParams()
 				{SCALE_Y,    Model::getDefPart().scale.y},
 				{SCALE_Z,    Model::getDefPart().scale.z}
 		};
-	}
+	});
 }
 
 double fS_stod(const string&  str, int start, size_t* size)
@@ -123,6 +120,58 @@ void State::rotate(const Pt3D &rotation)
 }
 
 
+/**
+ * Parse a number in place, without copying the characters that follow it
+ * @param str the beginning of the number; the number ends at the first character that cannot be its part
+ * @param start the position of the number in genotype, used in error messages
+ * @return the parsed value
+ */
+double fS_stod(const char *str, int start)
+{
+	char *parsedEnd;
+	errno = 0;
+	double value = strtod(str, &parsedEnd);
+	if (parsedEnd == str)
+		throw fS_Exception("Invalid numeric value", start);
+	if (errno == ERANGE)
+		throw fS_Exception("Invalid numeric value; out of range", start);
+	return value;
+}
+
+/**
+ * Find a neuron class by its name, given as a span of characters
+ * Names of all the classes are put in a hash map once, so parsing neurons does not search the library linearly.
+ * Classes registered after the map was built are still found by falling back to the library search.
+ * @param name the beginning of the name
+ * @param length the length of the name
+ * @param activeOnly if true, inactive classes are not found
+ * @return the neuron class or nullptr if there is no such class
+ */
+NeuroClass *findNeuroClass(const char *name, int length, bool activeOnly)
+{
+	static const std::unordered_map<string, NeuroClass *> classesByName = []()
+	{
+		std::unordered_map<string, NeuroClass *> result;
+		for (int i = 0; i < NeuroLibrary::staticlibrary.getClassCount(); i++)
+		{
+			NeuroClass *nc = NeuroLibrary::staticlibrary.getClass(i);
+			result.insert({nc->getName().c_str(), nc});
+		}
+		return result;
+	}();
+
+	NeuroClass *nc = nullptr;
+	auto it = classesByName.find(string(name, length));
+	if (it != classesByName.end())
+		nc = it->second;
+	else if (NeuroLibrary::staticlibrary.getClassCount() != int(classesByName.size()))
+		nc = NeuroLibrary::staticlibrary.findClass(SString(name, length), false);
+
+	if (nc != nullptr && activeOnly && !nc->active)
+		return nullptr;
+	return nc;
+}
+
 fS_Neuron::fS_Neuron(const char *str, int _start, int length)
 {
 	start = _start + 1;
@@ -130,43 +179,44 @@ fS_Neuron::fS_Neuron(const char *str, int _start, int length)
 	if (length == 0)
 		return;
 
-	vector<SString> inputStrings;
-	strSplit(SString(str, length), NEURON_INTERNAL_SEPARATOR, false, inputStrings);
-	if (inputStrings.empty())
-		return;
-
-	int inputStart = 0;
-	SString details = "N";
+	const char separator = NEURON_INTERNAL_SEPARATOR.c_str()[0];
+	const char *genoEnd = str + length;
+	const char *firstEnd = std::find(str, genoEnd, separator);
+	const char *inputStart = str;
 
-	SString tmp = inputStrings[0];
-	if(tmp.indexOf(':') != -1)
-		tmp = tmp.substr(0, tmp.indexOf(':'));
-
-	if (NeuroLibrary::staticlibrary.findClassIndex(tmp, true) != -1)
+	// The first element is the neuron class with its properties, unless it is already an input
+	const char *nameEnd = std::find(str, firstEnd, NEURON_I_W_SEPARATOR);
+	NeuroClass *neuroClass = findNeuroClass(str, int(nameEnd - str), true);
+	if (neuroClass != nullptr)
+	{
+		if (nameEnd == firstEnd)
+			setClass(neuroClass);
+		else
+			setDetails(SString(str, int(firstEnd - str)));
+		if (firstEnd == genoEnd)
+			return;
+		inputStart = firstEnd + 1;
+	} else
 	{
-		inputStart = 1;
-		details = inputStrings[0];
+		NeuroClass *defaultClass = findNeuroClass("N", 1, false);
+		if (defaultClass != nullptr)
+			setClass(defaultClass);
+		else
+			setDetails("N");
 	}
-	setDetails(details);
 
-	for (int i = inputStart; i < int(inputStrings.size()); i++)
+	// Inputs are parsed directly from the genotype string
+	while (true)
 	{
-		SString keyValue = inputStrings[i];
-		int separatorIndex = keyValue.indexOf(NEURON_I_W_SEPARATOR);
-		const char *buffer = keyValue.c_str();
-		size_t keyLength;
-		double value;
-		if (separatorIndex == -1)
-		{
-			keyLength = keyValue.length();
-			value = DEFAULT_NEURO_CONNECTION_WEIGHT;
-		} else
-		{
-			keyLength = separatorIndex;
-			size_t valueLength = keyValue.length() - (separatorIndex);
-			value = fS_stod(buffer + separatorIndex + 1, start, &valueLength);
-		}
-		inputs[fS_stod(buffer, start, &keyLength)] = value;
+		const char *inputEnd = std::find(inputStart, genoEnd, separator);
+		const char *weightSeparator = std::find(inputStart, inputEnd, NEURON_I_W_SEPARATOR);
+		double weight = DEFAULT_NEURO_CONNECTION_WEIGHT;
+		if (weightSeparator != inputEnd)
+			weight = fS_stod(weightSeparator + 1, start);
+		inputs.set(int(fS_stod(inputStart, start)), weight);
+		if (inputEnd == genoEnd)
+			break;
+		inputStart = inputEnd + 1;
 	}
 }
 
@@ -187,6 +237,8 @@ Node::Node(Substring &restOfGeno, Node *_parent, GenotypeParams _genotypeParams)
 		partDescription->shortenBy(restOfGeno.len);
 		if (restOfGeno.len > 0)
 			getChildren(restOfGeno);
+		for (int i = 0; i < int(children.size()); i++)
+			subtreeSize += children[i]->subtreeSize;
 	}
 	catch(fS_Exception &e)
 	{
@@ -195,6 +247,15 @@ Node::Node(Substring &restOfGeno, Node *_parent, GenotypeParams _genotypeParams)
 	}
 }
 
+Node::Node(Node *_parent, GenotypeParams _genotypeParams)
+{
+	prepareParams();
+	partDescription = new Substring("", 0, 0);
+	genotypeParams = _genotypeParams;
+	parent = _parent;
+	partShape = Part::Shape::SHAPE_ELLIPSOID;
+}
+
 Node::~Node()
 {
 	cleanUp();
@@ -363,8 +424,17 @@ double Node::getParam(const string &key, double defaultValue)
 }
 
 
-void Node::getState(State *_state, bool calculateLocation)
+int Node::getState(State *_state, bool calculateLocation, double *distanceTime)
+{
+	int distanceEvaluations = calculateState(_state, calculateLocation, distanceTime);
+	for (int i = 0; i < int(children.size()); i++)
+		distanceEvaluations += children[i]->getState(state, calculateLocation, distanceTime);
+	return distanceEvaluations;
+}
+
+int Node::calculateState(State *_state, bool calculateLocation, double *distanceTime)
 {
+	int distanceEvaluations = 0;
 	if (state != nullptr)
 		delete state;
 	if (parent == nullptr)
@@ -377,7 +447,7 @@ void Node::getState(State *_state, bool calculateLocation)
 	for (auto it = modifiers.begin(); it != modifiers.end(); ++it)
 	{
 		char mod = it->first;
-		double multiplier = pow(genotypeParams.modifierMultiplier, it->second);
+		double multiplier = getModifierMultiplier(mod);
 		if (mod == MODIFIERS[0])
 			state->ing *= multiplier;
 		else if (mod == MODIFIERS[1])
@@ -391,11 +461,19 @@ void Node::getState(State *_state, bool calculateLocation)
 		// Rotate
 		state->rotate(getVectorRotation());
 
-		double distance = calculateDistanceFromParent();
+		double distance;
+		if (distanceTime == nullptr)
+			distance = calculateDistanceFromParent();
+		else
+		{
+			auto start = std::chrono::steady_clock::now();
+			distance = calculateDistanceFromParent();
+			*distanceTime += fS_elapsedNanoseconds(start);
+		}
+		distanceEvaluations++;
 		state->addVector(distance);
 	}
-	for (int i = 0; i < int(children.size()); i++)
-		children[i]->getState(state, calculateLocation);
+	return distanceEvaluations;
 }
 
 void Node::getChildren(Substring &restOfGenotype)
@@ -510,141 +588,302 @@ Pt3D Node::getRotation()
 	return rotation;
 }
 
-void Node::buildModel(Model &model, Node *parent)
+void fS_ModelBuild::applyMappings()
 {
-	createPart();
-	model.addPart(part);
-	if (parent != nullptr)
-		addJointsToModel(model, parent);
-
-	for (int i = 0; i < int(neurons.size()); i++)
-	{
-		Neuro *neuro = new Neuro(*neurons[i]);
-		model.addNeuro(neuro);
-		neuro->addMapping(MultiRange(IRange(neurons[i]->start, neurons[i]->end)));
-		if (neuro->getClass()->preflocation == NeuroClass::PREFER_JOINT && parent != nullptr)
-		{
-			neuro->attachToJoint(model.getJoint(model.getJointCount() - 1));
-		} else
-			neuro->attachToPart(part);
-	}
+	for (int i = 0; i < int(pendingMappings.size()); i++)
+		pendingMappings[i].first->addMapping(pendingMappings[i].second);
+	pendingMappings.clear();
+}
 
-	model.checkpoint();
-	part->addMapping(partDescription->toMultiRange());
+void Node::recordDevelopment(vector<fS_DevelopmentStep> &developmentLog, int parentPart)
+{
+	int index = int(developmentLog.size());
+	developmentLog.emplace_back();
+	fS_DevelopmentStep &step = developmentLog.back();
+	step.node = this;
+	step.parentPart = parentPart;
+	step.jointShape = getJointShape();
+	getPartProperties(step);
 
 	for (int i = 0; i < int(children.size()); i++)
-	{
-		Node *child = children[i];
-		child->buildModel(model, this);
-	}
+		children[i]->recordDevelopment(developmentLog, index);
 }
 
-void Node::createPart()
+void Node::getPartProperties(fS_DevelopmentStep &step)
 {
-	part = new Part(partShape);
-	part->p = Pt3D(state->location);
+	step.partShape = partShape;
+	step.location = Pt3D(state->location);
+	step.friction = getParam(FRICTION) * state->fr;
+	step.ingestion = getParam(INGESTION) * state->ing;
+	calculateScale(step.scale);
+	step.rotation = getRotation();
+}
+
+void Node::setPartProperties(Part *target)
+{
+	fS_DevelopmentStep step;
+	getPartProperties(step);
+	step.setPartProperties(target);
+}
+
+double Node::getModifierMultiplier(char modifier)
+{
+	auto it = modifiers.find(modifier);
+	return pow(genotypeParams.modifierMultiplier, it != modifiers.end() ? it->second : 0);
+}
 
-	part->friction = getParam(FRICTION) * state->fr;
-	part->ingest = getParam(INGESTION) * state->ing;
-	calculateScale(part->scale);
-	part->setRot(getRotation());
+bool Node::hasSamePhenotype(Node *other)
+{
+	if (partShape != other->partShape || children.size() != other->children.size())
+		return false;
+	// The joint of the start node is not built
+	if (parent != nullptr && getJointShape() != other->getJointShape())
+		return false;
+	for (int i = 0; i < int(MODIFIERS.length()); i++)
+	{
+		if (getModifierMultiplier(MODIFIERS[i]) != other->getModifierMultiplier(MODIFIERS[i]))
+			return false;
+	}
+	for (const char *key : {SCALE, SCALE_X, SCALE_Y, SCALE_Z, FRICTION, INGESTION})
+	{
+		if (getParam(key) != other->getParam(key))
+			return false;
+	}
+	return getRotation() == other->getRotation() && getVectorRotation() == other->getVectorRotation();
 }
 
-void Node::addJointsToModel(Model &model, Node *parent)
+Joint::Shape Node::getJointShape()
 {
-	Joint *j = new Joint();
-	j->attachToParts(parent->part, part);
 	switch (joint)
 	{
 		case HINGE_X:
-			j->shape = Joint::Shape::SHAPE_HINGE_X;
-			break;
+			return Joint::Shape::SHAPE_HINGE_X;
 		case HINGE_XY:
-			j->shape = Joint::Shape::SHAPE_HINGE_XY;
-			break;
+			return Joint::Shape::SHAPE_HINGE_XY;
 		default:
-			j->shape = Joint::Shape::SHAPE_FIXED;
+			return Joint::Shape::SHAPE_FIXED;
+	}
+}
+
+int getNeuronPosition(const vector<int> &neuronPositions, int id)
+{
+	if (id < 0 || id >= int(neuronPositions.size()) || neuronPositions[id] == -1)
+		throw fS_Exception("Internal error: connection to a neuron that is not in genotype", 0);
+	return neuronPositions[id];
+}
+
+void fS_GenoWriter::writeInt(int value)
+{
+	char digits[12];
+	int count = 0;
+	unsigned int absValue = value < 0 ? 0u - unsigned(value) : unsigned(value);
+	do
+	{
+		digits[count++] = char('0' + absValue % 10);
+		absValue /= 10;
+	} while (absValue > 0);
+	if (value < 0)
+		buffer.push_back('-');
+	while (count > 0)
+		buffer.push_back(digits[--count]);
+}
+
+void fS_GenoWriter::writeFixed(double value, int precision)
+{
+	char digits[64];
+	int length = snprintf(digits, sizeof(digits), "%.*f", precision, value);
+	if (length < 0 || length >= int(sizeof(digits)))
+	{
+		// Too long for the local buffer; such values do not occur in practice
+		buffer.append(doubleToString(value, precision));
+		return;
+	}
+	if (memchr(digits, '.', length) != nullptr)
+	{
+		while (digits[length - 1] == '0')
+			length--;
+		if (digits[length - 1] == '.')
+			length--;
 	}
-	model.addJoint(j);
-	j->addMapping(partDescription->toMultiRange());
+	buffer.append(digits, length);
 }
 
+bool fS_quantizeFixed(double value, int precision, double quantum, int64_t &multiple)
+{
+	double scaled = value * quantum;
+	if (!(fabs(scaled) < MAX_QUANTIZED))
+		return false;
+	multiple = llround(scaled);
+	if (fabs(fabs(scaled - double(multiple)) - 0.5) < 1e-6)
+	{
+		char digits[64];
+		int length = snprintf(digits, sizeof(digits), "%.*f", precision, value);
+		char *end = std::remove(digits, digits + length, '.');
+		*end = 0;
+		multiple = strtoll(digits, nullptr, 10);
+	}
+	return true;
+}
+
+void fS_GenoWriter::writeNeuron(const SString &details, const std::pair<int, double> *inputs, int inputCount)
+{
+	write(details);
+	for (int i = 0; i < inputCount; i++)
+	{
+		write(NEURON_INTERNAL_SEPARATOR);
+		writeInt(inputs[i].first);
+		if (inputs[i].second != DEFAULT_NEURO_CONNECTION_WEIGHT)
+		{
+			write(NEURON_I_W_SEPARATOR);
+			write(SString::valueOf(inputs[i].second));
+		}
+	}
+}
+
+void Node::invalidateHash()
+{
+	// If a node has a valid hash, so do all its descendants; thus the ancestors of an invalid node are invalid too
+	for (Node *node = this; node != nullptr && node->hashCachePrecision != -1; node = node->parent)
+		node->hashCachePrecision = -1;
+}
+
+/// Get the bits of a number for hashing; both zeros are the same
+static uint64_t getHashBits(double value)
+{
+	if (value == 0)
+		return 0;
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+/// Get the bits for hashing a number written with fS_GenoWriter::writeFixed(), the same for values written the same way
+static uint64_t getFixedHashBits(double value, int precision, double quantum)
+{
+	int64_t multiple;
+	if (fS_quantizeFixed(value, precision, quantum, multiple))
+		return uint64_t(multiple);
+	return getHashBits(value);
+}
 
-void Node::getGeno(SString &result)
+uint64_t Node::getHash()
 {
-	if (joint != DEFAULT_JOINT)
-		result += joint;
+	if (hashCachePrecision == fS_Genotype::precision)
+		return hashCache;
+
+	int precision = fS_Genotype::precision;
+	uint64_t hash = fS_hashCombine(uint64_t(partShape), uint64_t(joint));
 	for (auto it = modifiers.begin(); it != modifiers.end(); ++it)
 	{
-		char mod = it->first;
-		int count = it->second;
-		if(it->second < 0)
+		// A modifier with the count of 0 is not written in genotype
+		if (it->second != 0)
+			hash = fS_hashCombine(fS_hashCombine(hash, uint64_t(it->first)), uint64_t(int64_t(it->second)));
+	}
+	// Params are quantized like in the fS representation, so that values written the same way have the same hash
+	double quantum = pow(10.0, precision);
+	for (auto it = params.begin(); it != params.end(); ++it)
+	{
+		hash = fS_hashString(hash, it->first.c_str(), int(it->first.length()));
+		hash = fS_hashCombine(hash, getFixedHashBits(it->second, precision, quantum));
+	}
+	hash = fS_hashCombine(hash, neurons.size());
+	for (int i = 0; i < int(neurons.size()); i++)
+	{
+		SString details = neurons[i]->getDetails();
+		hash = fS_hashString(hash, details.c_str(), details.length());
+	}
+	hash = fS_hashCombine(hash, children.size());
+	for (int i = 0; i < int(children.size()); i++)
+		hash = fS_hashCombine(hash, children[i]->getHash());
+
+	hashCache = hash;
+	hashCachePrecision = precision;
+	return hash;
+}
+
+void Node::getGeno(fS_GenoWriter &result, const vector<int> &neuronPositions)
+{
+	bool cacheValid = genoCachePrecision == fS_Genotype::precision;
+	int prefixStart = result.length();
+	if (cacheValid)
+		result.write(genoPrefixCache);
+	else
+	{
+		if (joint != DEFAULT_JOINT)
+			result.write(joint);
+		for (auto it = modifiers.begin(); it != modifiers.end(); ++it)
 		{
-			mod = tolower(mod);
-			count = fabs(count);
+			char mod = it->first;
+			int count = it->second;
+			if(it->second < 0)
+			{
+				mod = tolower(mod);
+				count = fabs(count);
+			}
+			result.write(mod, count);
 		}
-		result += std::string(count, mod).c_str();
+		result.write(SHAPE_TO_GENE.at(partShape));
+		genoPrefixCache.assign(result.c_str() + prefixStart, result.length() - prefixStart);
 	}
-	result += SHAPE_TO_GENE.at(partShape);
 
 	if (!neurons.empty())
 	{
 		// Add neurons to genotype string
-		result += NEURON_START;
+		result.write(NEURON_START);
+		vector<std::pair<int, double>> positionalInputs;
 		for (int i = 0; i < int(neurons.size()); i++)
 		{
 			fS_Neuron *n = neurons[i];
 			if (i != 0)
-				result += NEURON_SEPARATOR;
-
-			result += n->getDetails();
-			if (!n->inputs.empty())
-				result += NEURON_INTERNAL_SEPARATOR;
+				result.write(NEURON_SEPARATOR);
 
+			// Inputs are written in the order of their positions
+			positionalInputs.clear();
 			for (auto it = n->inputs.begin(); it != n->inputs.end(); ++it)
-			{
-				if (it != n->inputs.begin())
-					result += NEURON_INTERNAL_SEPARATOR;
-				result += SString::valueOf(it->first);
-				if (it->second != DEFAULT_NEURO_CONNECTION_WEIGHT)
-				{
-					result += NEURON_I_W_SEPARATOR;
-					result += SString::valueOf(it->second);
-				}
-			}
+				positionalInputs.push_back({getNeuronPosition(neuronPositions, it->first), it->second});
+			std::sort(positionalInputs.begin(), positionalInputs.end());
+			result.writeNeuron(n->getDetails(), positionalInputs.data(), int(positionalInputs.size()));
 		}
-		result += NEURON_END;
+		result.write(NEURON_END);
 	}
 
-	if (!params.empty())
+	if (cacheValid)
+		result.write(genoParamsCache);
+	else
 	{
-		// Add parameters to genotype string
-		result += PARAM_START;
-		for (auto it = params.begin(); it != params.end(); ++it)
+		int paramsStart = result.length();
+		if (!params.empty())
 		{
-			if (it != params.begin())
-				result += PARAM_SEPARATOR;
+			// Add parameters to genotype string
+			result.write(PARAM_START);
+			for (auto it = params.begin(); it != params.end(); ++it)
+			{
+				if (it != params.begin())
+					result.write(PARAM_SEPARATOR);
 
-			result += it->first.c_str();                    // Add parameter key to string
-			result += PARAM_KEY_VALUE_SEPARATOR;
-			// Round the value to two decimal places and add to string
-			result += doubleToString(it->second, fS_Genotype::precision).c_str();
+				result.write(it->first.c_str());                    // Add parameter key to string
+				result.write(PARAM_KEY_VALUE_SEPARATOR);
+				// Round the value to the genotype precision and add to string
+				result.writeFixed(it->second, fS_Genotype::precision);
+			}
+			result.write(PARAM_END);
 		}
-		result += PARAM_END;
+		genoParamsCache.assign(result.c_str() + paramsStart, result.length() - paramsStart);
+		genoCachePrecision = fS_Genotype::precision;
 	}
 
 	if (children.size() == 1)
-		children[0]->getGeno(result);
+		children[0]->getGeno(result, neuronPositions);
 	else if (children.size() > 1)
 	{
-		result += BRANCH_START;
+		result.write(BRANCH_START);
 		for (int i = 0; i < int(children.size()) - 1; i++)
 		{
-			children[i]->getGeno(result);
-			result += BRANCH_SEPARATOR;
+			children[i]->getGeno(result, neuronPositions);
+			result.write(BRANCH_SEPARATOR);
 		}
-		children.back()->getGeno(result);
-		result += BRANCH_END;
+		children.back()->getGeno(result, neuronPositions);
+		result.write(BRANCH_END);
 	}
 }
 
@@ -657,21 +896,31 @@ void Node::getAllNodes(vector<Node *> &allNodes)
 
 int Node::getNodeCount()
 {
-	vector<Node*> allNodes;
-	getAllNodes(allNodes);
-	return allNodes.size();
+	return subtreeSize;
+}
+
+void Node::changeSubtreeSize(int delta)
+{
+	for (Node *node = this; node != nullptr; node = node->parent)
+		node->subtreeSize += delta;
+}
+
+GenotypeParams fS_Genotype::getDefaultGenotypeParams()
+{
+	GenotypeParams genotypeParams;
+	genotypeParams.modifierMultiplier = 1.1;
+	genotypeParams.distanceTolerance = 0.1;
+	genotypeParams.relativeDensity = 10.0;
+	genotypeParams.turnWithRotation = false;
+	genotypeParams.paramMutationStrength = 0.4;
+	return genotypeParams;
 }
 
 fS_Genotype::fS_Genotype(const string &geno)
 {
 	try
 	{
-		GenotypeParams genotypeParams;
-		genotypeParams.modifierMultiplier = 1.1;
-		genotypeParams.distanceTolerance = 0.1;
-		genotypeParams.relativeDensity = 10.0;
-		genotypeParams.turnWithRotation = false;
-		genotypeParams.paramMutationStrength = 0.4;
+		GenotypeParams genotypeParams = getDefaultGenotypeParams();
 
 		size_t modeSeparatorIndex = geno.find(MODE_SEPARATOR);
 		if (modeSeparatorIndex == string::npos)
@@ -699,6 +948,11 @@ fS_Genotype::fS_Genotype(const string &geno)
 		Substring substring(geno.c_str(), genoStart, geno.length() - genoStart);
 		startNode = new Node(substring, nullptr, genotypeParams);
 		validateNeuroInputs();
+
+		// Neuron inputs are parsed as positions, so the initial identifiers are equal to positions
+		vector<fS_Neuron*> allNeurons = getAllNeurons();
+		for (int i = 0; i < int(allNeurons.size()); i++)
+			assignNeuronId(allNeurons[i]);
 	}
 	catch (fS_Exception &e)
 	{
@@ -709,41 +963,294 @@ fS_Genotype::fS_Genotype(const string &geno)
 
 fS_Genotype::~fS_Genotype()
 {
+	// Free the objects that were removed by edits that were never committed
+	for (int i = 0; i < int(editLog.size()); i++)
+	{
+		if (editLog[i].release)
+			editLog[i].release();
+	}
 	delete startNode;
 }
 
 void fS_Genotype::getState(bool calculateLocation)
 {
 	State *initialState = new State(Pt3D(0), Pt3D(1, 0, 0));
-	startNode->getState(initialState, calculateLocation);
+	stateCalculations++;
+	if (conversionTimes == nullptr)
+	{
+		distanceEvaluations += startNode->getState(initialState, calculateLocation);
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	double distanceTime = 0;
+	distanceEvaluations += startNode->getState(initialState, calculateLocation, &distanceTime);
+	conversionTimes->state += fS_elapsedNanoseconds(start) - distanceTime;
+	conversionTimes->distance += distanceTime;
 }
 
 Model fS_Genotype::buildModel(bool using_checkpoints)
 {
-
 	Model model;
+	buildModel(model, using_checkpoints);
+	return model;
+}
+
+void fS_Genotype::buildModel(Model &model, bool using_checkpoints, bool buildMapping)
+{
+	vector<fS_DevelopmentStep> developmentLog;
+	buildModel(model, developmentLog, using_checkpoints, buildMapping);
+}
+
+void fS_Genotype::addStep(Model &model, const fS_DevelopmentStep &step, fS_ModelBuild &build)
+{
+	Node *node = step.node;
+	Part *part = new Part(step.partShape);
+	step.setPartProperties(part);
+	model.addPart(part);
+	Joint *joint = nullptr;
+	if (step.parentPart >= 0)
+	{
+		joint = new Joint();
+		joint->attachToParts(model.getPart(step.parentPart), part);
+		joint->shape = step.jointShape;
+		model.addJoint(joint);
+		if (build.buildMapping)
+			build.pendingMappings.push_back({joint, node->partDescription->toIRange()});
+	}
+
+	for (int i = 0; i < int(node->neurons.size()); i++)
+	{
+		Neuro *neuro = new Neuro(*node->neurons[i]);
+		model.addNeuro(neuro);
+		if (build.buildMapping)
+			build.pendingMappings.push_back({neuro, IRange(node->neurons[i]->start, node->neurons[i]->end)});
+		if (neuro->getClass()->preflocation == NeuroClass::PREFER_JOINT && joint != nullptr)
+			neuro->attachToJoint(joint);
+		else
+			neuro->attachToPart(part);
+	}
+	if (build.buildMapping)
+		build.pendingMappings.push_back({part, node->partDescription->toIRange()});
+}
+
+void fS_Genotype::addSteps(Model &model, const vector<fS_DevelopmentStep> &developmentLog, int stepCount, fS_ModelBuild &build)
+{
+	for (int i = 0; i < stepCount; i++)
+	{
+		addStep(model, developmentLog[i], build);
+		if (model.isUsingCheckpoints())
+		{
+			// A checkpoint copies the model, so it needs the mappings of all its elements
+			build.applyMappings();
+			model.checkpoint();
+		}
+	}
+}
+
+void fS_Genotype::buildModel(Model &model, vector<fS_DevelopmentStep> &developmentLog, bool using_checkpoints, bool buildMapping)
+{
+	model.clear();
 	model.open(using_checkpoints);
 
 	getState(true);
-	startNode->buildModel(model, nullptr);
+	std::chrono::steady_clock::time_point start;
+	if (conversionTimes != nullptr)
+		start = std::chrono::steady_clock::now();
+	developmentLog.clear();
+	developmentLog.reserve(getNodeCount());
+	startNode->recordDevelopment(developmentLog, -1);
+	fS_ModelBuild build;
+	build.buildMapping = buildMapping;
+	addSteps(model, developmentLog, int(developmentLog.size()), build);
+	build.applyMappings();
 	buildNeuroConnections(model);
 
 	model.close();
-	return model;
+	clearChanges();
+	if (conversionTimes != nullptr)
+		conversionTimes->model += fS_elapsedNanoseconds(start);
+}
+
+void fS_Genotype::buildCheckpoint(Model &model, const vector<fS_DevelopmentStep> &developmentLog, int step)
+{
+	model.clear();
+	model.open(false);
+	fS_ModelBuild build;
+	addSteps(model, developmentLog, step + 1, build);
+	build.applyMappings();
+	model.close();
+}
+
+bool fS_Genotype::updateModel(Model &model)
+{
+	vector<Node *> allNodes = getAllNodes();
+	if (structureChanged || model.getPartCount() != int(allNodes.size()) || model.getJointCount() != int(allNodes.size()) - 1)
+	{
+		buildModel(model, false, false);
+		return false;
+	}
+	if (changedNodes.empty())
+		return true;
+
+	model.open();
+	// Parts and joints are built in the same order as getAllNodes() returns the nodes, and every node but the start one has a joint
+	int end = 0;	// The end of the last updated subtree
+	for (int i = 0; i < int(allNodes.size()); i++)
+	{
+		Node *node = allNodes[i];
+		if (i < end || changedNodes.find(node) == changedNodes.end())
+			continue;
+
+		// The state of the node comes from all its ancestors, whose states may have been calculated without locations since
+		vector<Node *> ancestors;
+		for (Node *ancestor = node; ancestor != nullptr; ancestor = ancestor->parent)
+			ancestors.push_back(ancestor);
+		stateCalculations++;
+		State *ancestorState = new State(Pt3D(0), Pt3D(1, 0, 0));
+		for (int j = int(ancestors.size()) - 1; j > 0; j--)
+		{
+			distanceEvaluations += ancestors[j]->calculateState(ancestorState, true);
+			ancestorState = ancestors[j]->state;
+		}
+		distanceEvaluations += node->getState(ancestorState, true);
+
+		end = i + node->getNodeCount();
+		for (int j = i; j < end; j++)
+		{
+			allNodes[j]->setPartProperties(model.getPart(j));
+			if (j > 0)
+				model.getJoint(j - 1)->shape = allNodes[j]->getJointShape();
+		}
+	}
+	model.close();
+	clearChanges();
+	return true;
+}
+
+bool fS_Genotype::hasSamePhenotype(fS_Genotype &other)
+{
+	const GenotypeParams &params = startNode->genotypeParams, &otherParams = other.startNode->genotypeParams;
+	if (params.modifierMultiplier != otherParams.modifierMultiplier || params.distanceTolerance != otherParams.distanceTolerance
+		|| params.relativeDensity != otherParams.relativeDensity || params.turnWithRotation != otherParams.turnWithRotation)
+		return false;
+
+	// Equal numbers of children of the nodes in preorder mean that the trees have the same shape
+	vector<Node *> nodes = getAllNodes(), otherNodes = other.getAllNodes();
+	if (nodes.size() != otherNodes.size())
+		return false;
+	vector<int> neuronPositions = getNeuronPositions(), otherNeuronPositions = other.getNeuronPositions();
+	for (int i = 0; i < int(nodes.size()); i++)
+	{
+		if (!nodes[i]->hasSamePhenotype(otherNodes[i]) || nodes[i]->neurons.size() != otherNodes[i]->neurons.size())
+			return false;
+		for (int j = 0; j < int(nodes[i]->neurons.size()); j++)
+		{
+			fS_Neuron *neuron = nodes[i]->neurons[j], *otherNeuron = otherNodes[i]->neurons[j];
+			if (neuron->getClass() != otherNeuron->getClass() || neuron->getDetails() != otherNeuron->getDetails()
+				|| neuron->inputs.size() != otherNeuron->inputs.size())
+				return false;
+			for (int k = 0; k < neuron->inputs.size(); k++)
+			{
+				if (getNeuronPosition(neuronPositions, neuron->inputs.getId(k)) != getNeuronPosition(otherNeuronPositions, otherNeuron->inputs.getId(k))
+					|| neuron->inputs.getWeight(k) != otherNeuron->inputs.getWeight(k))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+uint64_t fS_Genotype::getHash()
+{
+	const GenotypeParams &params = startNode->genotypeParams;
+	uint64_t hash = startNode->getHash();
+	// The genotype params are written with the same precision as the params of nodes
+	double quantum = pow(10.0, precision);
+	hash = fS_hashCombine(hash, getFixedHashBits(params.modifierMultiplier, precision, quantum));
+	hash = fS_hashCombine(hash, uint64_t(params.turnWithRotation));
+	hash = fS_hashCombine(hash, getFixedHashBits(params.paramMutationStrength, precision, quantum));
+
+	// Connections are hashed with the positions of neurons, like in the fS representation
+	vector<fS_Neuron *> allNeurons = getAllNeurons();
+	vector<int> neuronPositions = getNeuronPositions();
+	vector<std::pair<int, double>> positionalInputs;
+	for (int i = 0; i < int(allNeurons.size()); i++)
+	{
+		positionalInputs.clear();
+		for (auto it = allNeurons[i]->inputs.begin(); it != allNeurons[i]->inputs.end(); ++it)
+			positionalInputs.push_back({getNeuronPosition(neuronPositions, it->first), it->second});
+		std::sort(positionalInputs.begin(), positionalInputs.end());
+		hash = fS_hashCombine(hash, positionalInputs.size());
+		for (int j = 0; j < int(positionalInputs.size()); j++)
+		{
+			hash = fS_hashCombine(hash, positionalInputs[j].first);
+			// Weights are hashed as they are written, and the default one is not written
+			if (positionalInputs[j].second != DEFAULT_NEURO_CONNECTION_WEIGHT)
+			{
+				SString weight = SString::valueOf(positionalInputs[j].second);
+				hash = fS_hashString(hash, weight.c_str(), weight.length());
+			}
+		}
+	}
+	return hash;
 }
 
+void fS_Genotype::canonicalize()
+{
+	if (startNode->joint != DEFAULT_JOINT)
+		setJoint(startNode, DEFAULT_JOINT);
+
+	double quantum = pow(10.0, precision);
+	vector<Node *> allNodes = getAllNodes();
+	// Children before parents, so that the subtrees are already canonical when they are sorted
+	for (int i = int(allNodes.size()) - 1; i >= 0; i--)
+	{
+		Node *node = allNodes[i];
+		vector<string> defaultParams;
+		for (auto it = node->params.begin(); it != node->params.end(); ++it)
+		{
+			auto defaultItem = Node::defaultValues.find(it->first);
+			if (defaultItem != Node::defaultValues.end()
+				&& getFixedHashBits(it->second, precision, quantum) == getFixedHashBits(defaultItem->second, precision, quantum))
+				defaultParams.push_back(it->first);
+		}
+		for (int j = 0; j < int(defaultParams.size()); j++)
+			removeParam(node, defaultParams[j]);
+
+		if (node->genotypeParams.modifierMultiplier == 1.0)
+		{
+			for (auto it = node->modifiers.begin(); it != node->modifiers.end(); ++it)
+			{
+				if (it->second != 0)
+					setModifier(node, it->first, 0);
+			}
+		}
+
+		if (node->children.size() > 1)
+		{
+			vector<Node *> oldChildren = node->children;
+			std::stable_sort(node->children.begin(), node->children.end(), [](Node *a, Node *b) { return a->getHash() < b->getHash(); });
+			if (node->children != oldChildren)
+			{
+				node->invalidateHash();
+				recordEdit(nullptr, [node, oldChildren]() { node->children = oldChildren; node->invalidateHash(); });
+			}
+		}
+	}
+}
 
 void fS_Genotype::buildNeuroConnections(Model &model)
 {
 	// All the neurons are already created in the model
 	vector<fS_Neuron*> allNeurons = getAllNeurons();
+	vector<int> neuronPositions = getNeuronPositions();
 	for (int i = 0; i < int(allNeurons.size()); i++)
 	{
 		fS_Neuron *neuron = allNeurons[i];
 		Neuro *modelNeuro = model.getNeuro(i);
 		for (auto it = neuron->inputs.begin(); it != neuron->inputs.end(); ++it)
 		{
-			Neuro *inputNeuro = model.getNeuro(it->first);
+			Neuro *inputNeuro = model.getNeuro(getNeuronPosition(neuronPositions, it->first));
 			modelNeuro->addInput(inputNeuro, it->second);
 
 		}
@@ -774,19 +1281,20 @@ Node *fS_Genotype::getNearestNode(vector<Node *> allNodes, Node *node)
 
 SString fS_Genotype::getGeno()
 {
-	SString geno;
-	geno.reserve(100);
+	// The writer is kept between calls, so its buffer is already large enough for most genotypes
+	static thread_local fS_GenoWriter writer;
+	writer.clear();
 
 	GenotypeParams gp = startNode->genotypeParams;
-	geno += doubleToString(gp.modifierMultiplier, precision).c_str();
-	geno += ",";
-	geno += std::to_string(int(gp.turnWithRotation)).c_str();
-	geno += ",";
-	geno += doubleToString(gp.paramMutationStrength, precision).c_str();
-	geno += MODE_SEPARATOR;
-
-	startNode->getGeno(geno);
-	return geno;
+	writer.writeFixed(gp.modifierMultiplier, precision);
+	writer.write(',');
+	writer.writeInt(int(gp.turnWithRotation));
+	writer.write(',');
+	writer.writeFixed(gp.paramMutationStrength, precision);
+	writer.write(MODE_SEPARATOR);
+
+	startNode->getGeno(writer, getNeuronPositions());
+	return SString(writer.c_str(), writer.length());
 }
 
 vector<fS_Neuron *> fS_Genotype::extractNeurons(Node *node)
@@ -805,49 +1313,258 @@ vector<fS_Neuron *> fS_Genotype::extractNeurons(Node *node)
 	return allNeurons;
 }
 
-int fS_Genotype::getNeuronIndex(vector<fS_Neuron *> neurons, fS_Neuron *changedNeuron)
+void fS_Genotype::assignNeuronId(fS_Neuron *neuron)
+{
+	neuron->id = nextNeuronId++;
+}
+
+void fS_Genotype::removeConnectionsFrom(const vector<fS_Neuron *> &neurons)
 {
-	int neuronIndex = -1;
+	if (neurons.empty())
+		return;
+	std::set<int> removedIds;
 	for (int i = 0; i < int(neurons.size()); i++)
+		removedIds.insert(neurons[i]->id);
+
+	vector<fS_Neuron*> allNeurons = getAllNeurons();
+	for (int i = 0; i < int(allNeurons.size()); i++)
 	{
-		if (changedNeuron == neurons[i])
-		{
-			neuronIndex = i;
-			break;
-		}
+		fS_Neuron *neuron = allNeurons[i];
+		fS_NeuronInputs oldInputs = neuron->inputs;
+		neuron->inputs.removeAll(removedIds);
+		if (neuron->inputs.size() != oldInputs.size())
+			recordEdit(nullptr, [neuron, oldInputs]() { neuron->inputs = oldInputs; });
+	}
+}
+
+void fS_Genotype::markChanged(Node *changedNode)
+{
+	if (changedNode != nullptr)
+		changedNodes.insert(changedNode);
+	else
+		structureChanged = true;
+}
+
+void fS_Genotype::recordEdit(Node *changedNode, std::function<void()> undo, std::function<void()> release)
+{
+	markChanged(changedNode);
+	if (editDepth > 0)
+		editLog.push_back({changedNode, undo, release});
+	else if (release)
+		release();
+}
+
+int fS_Genotype::beginEdits()
+{
+	editDepth++;
+	return int(editLog.size());
+}
+
+void fS_Genotype::commitEdits()
+{
+	if (editDepth == 0)
+		throw fS_Exception("Internal error: commit without beginning the edits", 0);
+	if (--editDepth > 0)
+		return;
+	for (int i = 0; i < int(editLog.size()); i++)
+	{
+		if (editLog[i].release)
+			editLog[i].release();
 	}
-	return neuronIndex;
+	editLog.clear();
 }
 
-void fS_Genotype::shiftNeuroConnections(vector<fS_Neuron *> &neurons, int start, int end, SHIFT shift)
+void fS_Genotype::rollbackEdits(int mark)
 {
-	if (start == -1 || end == -1)
+	if (editDepth == 0)
+		throw fS_Exception("Internal error: rollback without beginning the edits", 0);
+	for (int i = int(editLog.size()) - 1; i >= mark; i--)
+	{
+		editLog[i].undo();
+		markChanged(editLog[i].changedNode);
+	}
+	editLog.resize(mark);
+	editDepth--;
+}
+
+void fS_Genotype::setParam(Node *node, const string &key, double value)
+{
+	auto it = node->params.find(key);
+	if (it == node->params.end())
+	{
+		node->params[key] = value;
+		recordEdit(node, [node, key]() { node->params.erase(key); node->invalidateGenoCache(); });
+	} else
+	{
+		double oldValue = it->second;
+		it->second = value;
+		recordEdit(node, [node, key, oldValue]() { node->params[key] = oldValue; node->invalidateGenoCache(); });
+	}
+	node->invalidateGenoCache();
+}
+
+void fS_Genotype::removeParam(Node *node, const string &key)
+{
+	auto it = node->params.find(key);
+	if (it == node->params.end())
 		return;
-	int shiftValue = end - start + 1;
-	if (shift == SHIFT::LEFT)
-		shiftValue *= -1;
+	double oldValue = it->second;
+	node->params.erase(it);
+	node->invalidateGenoCache();
+	recordEdit(node, [node, key, oldValue]() { node->params[key] = oldValue; node->invalidateGenoCache(); });
+}
 
-	for (int i = 0; i < int(neurons.size()); i++)
+void fS_Genotype::setModifier(Node *node, char modifier, int count)
+{
+	int oldCount = node->modifiers[modifier];
+	node->modifiers[modifier] = count;
+	node->invalidateGenoCache();
+	recordEdit(node, [node, modifier, oldCount]() { node->modifiers[modifier] = oldCount; node->invalidateGenoCache(); });
+}
+
+void fS_Genotype::setJoint(Node *node, char joint)
+{
+	char oldJoint = node->joint;
+	node->joint = joint;
+	node->invalidateGenoCache();
+	recordEdit(node, [node, oldJoint]() { node->joint = oldJoint; node->invalidateGenoCache(); });
+}
+
+void fS_Genotype::setPartShape(Node *node, Part::Shape partShape)
+{
+	Part::Shape oldShape = node->partShape;
+	node->partShape = partShape;
+	node->invalidateGenoCache();
+	recordEdit(node, [node, oldShape]() { node->partShape = oldShape; node->invalidateGenoCache(); });
+}
+
+void fS_Genotype::saveNeuronInputs(fS_Neuron *neuron)
+{
+	markChanged(nullptr);
+	if (editDepth == 0)
+		return;
+	fS_NeuronInputs oldInputs = neuron->inputs;
+	recordEdit(nullptr, [neuron, oldInputs]() { neuron->inputs = oldInputs; });
+}
+
+void fS_Genotype::saveNeuronDetails(fS_Neuron *neuron)
+{
+	markChanged(nullptr);
+	// Neurons do not know their nodes, and the details are a part of the hash of the node
+	Node *node = nullptr;
+	vector<Node *> allNodes = getAllNodes();
+	for (int i = 0; i < int(allNodes.size()) && node == nullptr; i++)
 	{
-		fS_Neuron *n = neurons[i];
-		std::map<int, double> newInputs;
-		for (auto it = n->inputs.begin(); it != n->inputs.end(); ++it)
-		{
-			if (start > it->first)
-				newInputs[it->first] = it->second;
-			else if (it->first >= start)
-			{
-				if (end >= it->first)
-				{
-					if (shift == SHIFT::RIGHT)
-						newInputs[it->first + shiftValue] = it->second;
-					// If shift == -1, just delete the input
-				} else if (it->first > end)
-					newInputs[it->first + shiftValue] = it->second;
-			}
-		}
-		n->inputs = newInputs;
+		if (std::find(allNodes[i]->neurons.begin(), allNodes[i]->neurons.end(), neuron) != allNodes[i]->neurons.end())
+			node = allNodes[i];
+	}
+	if (node != nullptr)
+		node->invalidateHash();
+	if (editDepth == 0)
+		return;
+	SString oldDetails = neuron->getDetails();
+	recordEdit(nullptr, [node, neuron, oldDetails]()
+	{
+		neuron->setDetails(oldDetails);
+		if (node != nullptr)
+			node->invalidateHash();
+	});
+}
+
+void fS_Genotype::addNeuron(Node *node, fS_Neuron *neuron)
+{
+	node->neurons.push_back(neuron);
+	node->invalidateHash();
+	assignNeuronId(neuron);
+	recordEdit(nullptr, [node, neuron]()
+	{
+		node->neurons.erase(std::find(node->neurons.begin(), node->neurons.end(), neuron));
+		node->invalidateHash();
+		delete neuron;
+	});
+}
+
+void fS_Genotype::removeNeuron(Node *node, int index)
+{
+	fS_Neuron *neuron = node->neurons[index];
+	removeConnectionsFrom({neuron});        // Important to remove the connections before deleting
+	// Keep the order of the remaining neurons, as it determines their positions
+	node->neurons.erase(node->neurons.begin() + index);
+	node->invalidateHash();
+	recordEdit(nullptr, [node, index, neuron]()
+	{
+		node->neurons.insert(node->neurons.begin() + index, neuron);
+		node->invalidateHash();
+	}, [neuron]() { delete neuron; });
+}
+
+void fS_Genotype::addChild(Node *parent, Node *child)
+{
+	parent->children.push_back(child);
+	parent->changeSubtreeSize(child->subtreeSize);
+	parent->invalidateHash();
+	recordEdit(nullptr, [parent, child]()
+	{
+		parent->children.erase(std::find(parent->children.begin(), parent->children.end(), child));
+		parent->changeSubtreeSize(-child->subtreeSize);
+		parent->invalidateHash();
+		delete child;
+	});
+}
+
+void fS_Genotype::removeChild(Node *parent, int index)
+{
+	Node *child = parent->children[index];
+	int lastIndex = int(parent->children.size()) - 1;
+	swap(parent->children[index], parent->children[lastIndex]);
+	parent->children.pop_back();
+	parent->changeSubtreeSize(-child->subtreeSize);
+	parent->invalidateHash();
+	recordEdit(nullptr, [parent, child, index, lastIndex]()
+	{
+		parent->children.push_back(child);
+		swap(parent->children[index], parent->children[lastIndex]);
+		parent->invalidateHash();
+		parent->changeSubtreeSize(child->subtreeSize);
+	}, [child]() { delete child; });
+}
+
+void fS_Genotype::compactNeuronIds(const vector<fS_Neuron *> &allNeurons)
+{
+	vector<int> newIds(nextNeuronId, -1);
+	for (int i = 0; i < int(allNeurons.size()); i++)
+	{
+		int id = allNeurons[i]->id;
+		if (id < 0 || id >= nextNeuronId)
+			throw fS_Exception("Internal error: neuron without a valid identifier", 0);
+		newIds[id] = i;
+	}
+	for (int i = 0; i < int(allNeurons.size()); i++)
+	{
+		fS_Neuron *neuron = allNeurons[i];
+		neuron->id = i;
+		fS_NeuronInputs oldInputs = neuron->inputs;
+		neuron->inputs.clear();
+		for (auto it = oldInputs.begin(); it != oldInputs.end(); ++it)
+			neuron->inputs.set(getNeuronPosition(newIds, it->first), it->second);
 	}
+	nextNeuronId = int(allNeurons.size());
+}
+
+vector<int> fS_Genotype::getNeuronPositions()
+{
+	vector<fS_Neuron*> allNeurons = getAllNeurons();
+	if (editDepth == 0 && nextNeuronId > 2 * int(allNeurons.size()) + MIN_NEURON_IDS_TO_COMPACT)
+		compactNeuronIds(allNeurons);
+	vector<int> positions(nextNeuronId, -1);
+	for (int i = 0; i < int(allNeurons.size()); i++)
+	{
+		int id = allNeurons[i]->id;
+		if (id < 0 || id >= nextNeuronId)
+			throw fS_Exception("Internal error: neuron without a valid identifier", 0);
+		positions[id] = i;
+	}
+	return positions;
 }
 
 vector<Node *> fS_Genotype::getAllNodes()
@@ -857,15 +1574,24 @@ vector<Node *> fS_Genotype::getAllNodes()
 	return allNodes;
 }
 
+std::map<int, vector<Node *>> fS_Genotype::getNodesBySubtreeSize()
+{
+	std::map<int, vector<Node *>> result;
+	vector<Node*> allNodes = getAllNodes();
+	for (int i = 0; i < int(allNodes.size()); i++)
+		result[allNodes[i]->subtreeSize].push_back(allNodes[i]);
+	return result;
+}
+
 vector<fS_Neuron *> fS_Genotype::getAllNeurons()
 {
 	return extractNeurons(startNode);
 }
 
-Node *fS_Genotype::chooseNode(int fromIndex)
+Node *fS_Genotype::chooseNode(RandomGenerator &rng, int fromIndex)
 {
 	vector<Node*> allNodes = getAllNodes();
-	return allNodes[fromIndex + rndUint(allNodes.size() - fromIndex)];
+	return allNodes[fromIndex + randomUint(rng, allNodes.size() - fromIndex)];
 }
 
 int fS_Genotype::getNodeCount()
@@ -906,13 +1632,6 @@ void fS_Genotype::validateNeuroInputs()
 }
 
 
-void fS_Genotype::rearrangeNeuronConnections(fS_Neuron *changedNeuron, SHIFT shift)
-{
-	vector<fS_Neuron*> neurons = getAllNeurons();
-	int changedNeuronIndex = getNeuronIndex(neurons, changedNeuron);
-	shiftNeuroConnections(neurons, changedNeuronIndex, changedNeuronIndex, shift);
-}
-
 double Node::calculateDistanceFromParent()
 {
 	Pt3D scale;
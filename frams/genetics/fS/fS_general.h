@@ -7,11 +7,21 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <chrono>
 #include <map>
+#include <set>
 #include <unordered_map>
 #include <exception>
+#include <functional>
+#include <atomic>
+#include <mutex>
 #include "frams/model/model.h"
 #include "frams/util/multirange.h"
+#include "common/nonstd_math.h"
 
 /** @name Values of constants used in encoding */
 //@{
@@ -30,13 +40,6 @@ const SString NEURON_INTERNAL_SEPARATOR("'");
 #define NEURON_I_W_SEPARATOR ':'
 //@}
 
-enum class SHIFT
-{
-	LEFT = -1,
-	RIGHT = 1
-};
-
-
 /** @name Names of node parameters and modifiers*/
 //@{
 #define INGESTION "i"
@@ -59,6 +62,7 @@ enum class SHIFT
 #define HINGE_XY 'c'
 
 const double DEFAULT_NEURO_CONNECTION_WEIGHT = 1.0;
+const int MIN_NEURON_IDS_TO_COMPACT = 64;	/// Unused neuron identifiers above twice the neuron count that trigger their compaction
 
 const char ELLIPSOID = 'E';
 const char CUBOID = 'C';
@@ -114,6 +118,23 @@ public:
 	}
 };
 
+/**
+ * Find a neuron class by its name, given as a span of characters
+ * @param name the beginning of the name
+ * @param length the length of the name
+ * @param activeOnly if true, inactive classes are not found
+ * @return the neuron class or nullptr if there is no such class
+ */
+NeuroClass *findNeuroClass(const char *name, int length, bool activeOnly);
+
+/**
+ * Translates the id of a neuron into its position in genotype
+ * @param neuronPositions positions of neurons in genotype, as returned by fS_Genotype::getNeuronPositions()
+ * @param id the id of the neuron
+ * @return the position of the neuron; throws fS_Exception if the neuron is not in genotype
+ */
+int getNeuronPosition(const vector<int> &neuronPositions, int id);
+
 /**
  * Draws an integer value from given range
  * @param to maximal value
@@ -122,6 +143,125 @@ public:
  */
 int randomFromRange(int to, int from);
 
+/**
+ * Draws an integer value from the range 0 ... limit-1
+ * @param rng the random generator to draw from
+ * @param limit the number of possible values
+ * @return Drawn value, 0 if limit is 0
+ */
+inline unsigned int randomUint(RandomGenerator &rng, unsigned int limit)
+{
+	if (limit == 0)
+		return 0;
+	return std::min(limit - 1, (unsigned int) rng.Uni(0, limit));
+}
+
+class Node;
+
+/**
+ * One step of the development of a model built from fS genotype: a single part with its joint and neurons
+ * The step keeps the properties of the part calculated from the state of its node, so the model of any step
+ * can be built from the development log without calculating the states again.
+ */
+struct fS_DevelopmentStep
+{
+	Node *node;	/// The node that the part is built from; the neurons of the node are added in the same step
+	int parentPart;	/// The index of the part that the joint of this step connects to, or -1 if the step adds no joint
+	Joint::Shape jointShape;
+	Part::Shape partShape;
+	Pt3D location;
+	Pt3D rotation;
+	Pt3D scale;
+	double friction;
+	double ingestion;
+
+	/// Set the shape, location, rotation, scale and physical properties of the part
+	void setPartProperties(Part *target) const
+	{
+		target->shape = partShape;
+		target->p = location;
+		target->friction = friction;
+		target->ingest = ingestion;
+		target->scale = scale;
+		target->setRot(rotation);
+	}
+};
+
+/**
+ * Time spent in the stages of converting fS genotypes, in nanoseconds
+ */
+struct fS_ConversionTimes
+{
+	double parse = 0;	/// Building the tree of nodes from the genotype text
+	double state = 0;	/// Calculating the states of nodes, except for the distances between parts
+	double distance = 0;	/// Calculating the distances between parts
+	double model = 0;	/// Adding parts, joints and neurons to the model
+	double f0 = 0;	/// Writing the model as f0 genotype
+
+	void add(const fS_ConversionTimes &other)
+	{
+		parse += other.parse;
+		state += other.state;
+		distance += other.distance;
+		model += other.model;
+		f0 += other.f0;
+	}
+};
+
+/// The number of nanoseconds that passed since start
+inline double fS_elapsedNanoseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Mix a value into a 64-bit hash
+ * The finalizer of MurmurHash3 makes every bit of the value affect the whole result.
+ */
+inline uint64_t fS_hashCombine(uint64_t hash, uint64_t value)
+{
+	uint64_t x = hash ^ (value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2));
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDull;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+/// Mix the characters of a string into a 64-bit hash
+inline uint64_t fS_hashString(uint64_t hash, const char *str, int length)
+{
+	uint64_t chars = 0xCBF29CE484222325ull;	// FNV-1a
+	for (int i = 0; i < length; i++)
+		chars = (chars ^ (unsigned char) str[i]) * 0x100000001B3ull;
+	return fS_hashCombine(hash, chars ^ uint64_t(length));
+}
+
+const int64_t MAX_QUANTIZED = int64_t(1) << 52;	/// Larger multiples of 10^-precision are not exact in doubles
+
+/**
+ * Get the multiple of 10^-precision that is written for the value by fS_GenoWriter::writeFixed()
+ * Close to the middle between two multiples, the product with the quantum may be rounded differently than
+ * the decimal digits, so the digits are printed then. Values that are written the same way get the same multiple.
+ * @param quantum 10^precision
+ * @param multiple set to the multiple
+ * @return false if the multiple is too large to be exact; then it is not set
+ */
+bool fS_quantizeFixed(double value, int precision, double quantum, int64_t &multiple);
+
+/**
+ * The state of building a model from fS genotype, passed down the tree of nodes
+ */
+struct fS_ModelBuild
+{
+	bool buildMapping = true;	/// Whether the genotype ranges of the model elements are collected
+	vector<std::pair<PartBase *, IRange>> pendingMappings;	/// The collected ranges that are not in the model yet
+
+	/// Add all the pending genotype ranges to their model elements
+	void applyMappings();
+};
+
 /**
  * Represents a substring of a larger string.
  * The reference to the original string is stored along with indexes of beginning end length of the substring.
@@ -188,9 +328,14 @@ public:
 	 * @return a created multirange
 	 */
 	MultiRange toMultiRange()
+	{
+		return MultiRange(toIRange());
+	}
+
+	IRange toIRange()
 	{
 		int end = start + len - 1;
-		return MultiRange(IRange(start, end));
+		return IRange(start, end);
 	}
 };
 
@@ -227,14 +372,75 @@ public:
 	void rotate(const Pt3D &rotation);
 };
 
+/**
+ * Inputs of a neuron, stored as a vector of (identifier, weight) pairs sorted by identifier
+ * Neurons have few inputs, so a contiguous sorted vector is cheaper to build, copy and iterate than a map
+ */
+class fS_NeuronInputs
+{
+	vector<std::pair<int, double>> entries;
+
+	vector<std::pair<int, double>>::iterator find(int id)
+	{
+		return std::lower_bound(entries.begin(), entries.end(), std::make_pair(id, -DBL_MAX));
+	}
+
+public:
+	int size() const { return int(entries.size()); }
+	bool empty() const { return entries.empty(); }
+	void clear() { entries.clear(); }
+
+	int getId(int index) const { return entries[index].first; }
+	double getWeight(int index) const { return entries[index].second; }
+	void setWeight(int index, double weight) { entries[index].second = weight; }
+
+	bool contains(int id)
+	{
+		auto it = find(id);
+		return it != entries.end() && it->first == id;
+	}
+
+	/**
+	 * Add a connection from the neuron with the given identifier, or change its weight if it already exists
+	 */
+	void set(int id, double weight)
+	{
+		auto it = find(id);
+		if (it != entries.end() && it->first == id)
+			it->second = weight;
+		else
+			entries.insert(it, {id, weight});
+	}
+
+	void removeAt(int index)
+	{
+		entries.erase(entries.begin() + index);
+	}
+
+	/**
+	 * Remove all the connections from the neurons with given identifiers
+	 */
+	void removeAll(const std::set<int> &ids)
+	{
+		entries.erase(std::remove_if(entries.begin(), entries.end(),
+				[&ids](const std::pair<int, double> &e) { return ids.count(e.first) > 0; }), entries.end());
+	}
+
+	vector<std::pair<int, double>>::const_iterator begin() const { return entries.begin(); }
+	vector<std::pair<int, double>>::const_iterator end() const { return entries.end(); }
+};
+
 /**
  * Represent a neuron and its inputs
+ * While the genotype is in memory, neurons refer to their inputs by identifiers, that do not change when
+ * other neurons are added or removed. Positional indexes are used only in the text form of the genotype.
  */
 class fS_Neuron: public Neuro
 {
 public:
 	int start, end;
-	std::map<int, double> inputs;
+	int id = -1;	/// The identifier of the neuron, unique in the genotype
+	fS_NeuronInputs inputs;	/// Identifiers of input neurons and weights of connections
 
 	fS_Neuron(const char *str, int start, int length);
 
@@ -257,6 +463,45 @@ struct GenotypeParams{
 	double paramMutationStrength;
 };
 
+/**
+ * A byte buffer that the text form of a genotype is written into
+ * The buffer keeps its capacity when cleared, so a writer that is reused does not allocate memory once it has grown.
+ */
+class fS_GenoWriter
+{
+	string buffer;
+public:
+	void clear() { buffer.clear(); }
+	void reserve(int size) { buffer.reserve(size); }
+	int length() const { return int(buffer.size()); }
+	const char *c_str() const { return buffer.c_str(); }
+
+	void write(char c) { buffer.push_back(c); }
+	void write(char c, int count) { buffer.append(count, c); }
+	void write(const char *str) { buffer.append(str); }
+	void write(const SString &str) { buffer.append(str.c_str(), str.length()); }
+	void write(const string &str) { buffer.append(str); }
+
+	/**
+	 * Write an integer without creating any temporary string
+	 */
+	void writeInt(int value);
+
+	/**
+	 * Write a number like printf("%.*f", precision, value), then remove the trailing zeros after the decimal point
+	 * and the point itself if nothing remains after it. No temporary string is created.
+	 * This is the text that doubleToString(value, precision) gave for the genotypes; testGenoWriter in fS_test checks it
+	 */
+	void writeFixed(double value, int precision);
+
+	/**
+	 * Write the details and the inputs of a neuron
+	 * @param inputs the positions of the input neurons and the weights of connections, sorted by positions
+	 * @param inputCount the number of inputs
+	 */
+	void writeNeuron(const SString &details, const std::pair<int, double> *inputs, int inputCount);
+};
+
 /**
  * Represents a node in the graph that represents a genotype.
  * A node corresponds to a single part.
@@ -268,11 +513,15 @@ class Node
 
 	friend class GenoOper_fS;
 
+	friend class fS_SubtreeStore;
+
+	friend class fS_BinaryCodec;
+
 private:
 	Substring *partDescription = nullptr;
 	Node *parent;
-	Part *part;     /// A part object built from node. Used in building the Model
 	int partCodeLen; /// The length of substring that directly describes the corresponding part
+	int subtreeSize = 1; /// The number of nodes in the subtree that starts in this node
 	static std::map<string, double> minValues;	/// Min parameter values
 	static std::map<string, double> defaultValues;	/// Default parameter values
 	static std::map<string, double> maxValues;	/// Max parameter values
@@ -281,6 +530,7 @@ private:
 	std::map<char, int> modifiers;     /// Vector of all modifiers
 	vector<fS_Neuron *> neurons;    /// Vector of all the neurons
 
+	/// Fill minValues, defaultValues and maxValues; only the first call from any thread does the work
 	void prepareParams();
 
 	void cleanUp();
@@ -334,8 +584,18 @@ private:
 	 * Get phenotypic state that derives from ancestors.
 	 * Used when building model
 	 * @param _state state of the parent
+	 * @param distanceTime if not null, the time of calculating the distances is added to it
+	 * @return the number of distances between parts that were calculated
+	 */
+	int getState(State *_state, bool calculateLocation, double *distanceTime = nullptr);
+
+	/**
+	 * Calculate the state of this node only, without its descendants
+	 * @param _state state of the parent
+	 * @param distanceTime if not null, the time of calculating the distance is added to it
+	 * @return the number of distances between parts that were calculated
 	 */
-	void getState(State *_state, bool calculateLocation);
+	int calculateState(State *_state, bool calculateLocation, double *distanceTime = nullptr);
 
 	/**
 	 * Build children internal representations from fS genotype
@@ -344,17 +604,29 @@ private:
 	void getChildren(Substring &restOfGenotype);
 
 	/**
-	 * Create part object from internal representation
+	 * Calculate the shape, location, rotation, scale and physical properties of the part from the node and its state
+	 * @param step the development step whose part properties are set
 	 */
-	void createPart();
+	void getPartProperties(fS_DevelopmentStep &step);
 
 	/**
-	 * Add joints between current node and the specified child
-	 * Used in building model
-	 * @param mode pointer to build model
-	 * @param child pointer to the child
+	 * Set the shape, location, rotation, scale and physical properties of the part from the node and its state
+	 * @param target the part to set, either a new one or the one already built from this node
 	 */
-	void addJointsToModel(Model &model, Node *parent);
+	void setPartProperties(Part *target);
+
+	/// Get the shape of the joint between this node and its parent
+	Joint::Shape getJointShape();
+
+	/// Get the value that the modifiers of the given type multiply the state by
+	double getModifierMultiplier(char modifier);
+
+	/**
+	 * Check if this node and the other one build the same part and joint, and change the state in the same way
+	 * Params are compared by their effective values, so a param set to its default value equals a missing one.
+	 * Neurons and children are not compared.
+	 */
+	bool hasSamePhenotype(Node *other);
 
 	/**
 	 * Get all the nodes from the subtree that starts in this node
@@ -362,29 +634,94 @@ private:
 	 */
 	void getAllNodes(vector<Node *> &allNodes);
 
+	/**
+	 * Update the subtree size of this node and all its ancestors
+	 * Must be called after a subtree is attached to or detached from this node
+	 * @param delta the change in the number of nodes
+	 */
+	void changeSubtreeSize(int delta);
+
 
 	/**
-	 * Build model from the subtree that starts in this node
-	 * @param pointer to model
+	 * Add the development steps of the subtree that starts in this node to the log, one step per node in pre-order
+	 * The states of the nodes must be calculated with locations.
+	 * @param parentPart the index of the step of the parent node, or -1 for the start node
 	 */
-	void buildModel(Model &model, Node *parent);
+	void recordDevelopment(vector<fS_DevelopmentStep> &developmentLog, int parentPart);
 
-public:
+	/**
+	 * Create a node that is not parsed from text; the caller sets its part type and other properties
+	 * The node has no text, so it is mapped to an empty range.
+	 */
+	Node(Node *parent, GenotypeParams genotypeParams);
+
+	/**
+	 * The joint, part type and params are changed only through the editing methods of fS_Genotype,
+	 * which invalidate the cached text and hashes of the node
+	 */
 	char joint = DEFAULT_JOINT;           /// Set of all joints
 	Part::Shape partShape;  /// The type of the part
-	State *state = nullptr; /// The phenotypic state that inherits from ancestors
 	std::map<string, double> params; /// The map of all the node params
+
+public:
+	State *state = nullptr; /// The phenotypic state that inherits from ancestors
 	GenotypeParams genotypeParams; /// Parameters that affect the whole genotype
 
+	/// Serialized joint, modifiers and part type of this node, reused until the node changes
+	string genoPrefixCache;
+	/// Serialized params of this node, reused until the node changes
+	string genoParamsCache;
+	/// The precision that the cached params were written with, or -1 if the cache is not valid
+	int genoCachePrecision = -1;
+
+	/// The structural hash of the subtree, reused until the subtree changes
+	uint64_t hashCache = 0;
+	/// The precision that the params were quantized with in the cached hash, or -1 if the cached hash is not valid
+	int hashCachePrecision = -1;
+
 	Node(Substring &genotype, Node *parent, GenotypeParams genotypeParams);
 
 	~Node();
 
+	char getJoint() const { return joint; }
+
+	Part::Shape getPartShape() const { return partShape; }
+
+	/// Get the params that are set in the genotype; use fS_Genotype::setParam() and removeParam() to change them
+	const std::map<string, double> &getParams() const { return params; }
+
 	/**
 	 * Get fS representation of the subtree that starts from this node
-	 * @param result the reference to an object which is used to contain fS genotype
+	 * @param result the writer that the fS genotype is appended to
+	 * @param neuronPositions positions of neurons in genotype, as returned by fS_Genotype::getNeuronPositions()
 	 */
-	void getGeno(SString &result);
+	void getGeno(fS_GenoWriter &result, const vector<int> &neuronPositions);
+
+	/**
+	 * Must be called after the joint, modifiers, part type or params of this node are changed
+	 * Neurons are written anew every time, because their inputs depend on the positions of neurons in the whole genotype.
+	 */
+	void invalidateGenoCache()
+	{
+		genoCachePrecision = -1;
+		invalidateHash();
+	}
+
+	/**
+	 * Must be called after anything in the subtree that starts in this node is changed, including its neurons and children
+	 * The hashes of the ancestors are invalidated too, as they depend on the hash of this node.
+	 */
+	void invalidateHash();
+
+	/**
+	 * Get the structural hash of the subtree that starts in this node
+	 * Combines the joint, modifiers, part type, params quantized like in the fS representation (see fS_quantizeFixed()),
+	 * neuron details and the hashes of the children. Connections between neurons are not included,
+	 * as they may lead outside the subtree; fS_Genotype::getHash() includes them.
+	 * Equal subtrees have equal hashes, wherever they are. The hash is cached until invalidateHash() is called.
+	 * @return the 64-bit hash
+	 */
+	uint64_t getHash();
 
 	/**
 	 * Calculate the effective scale of the part (after applying all multipliers and params)
@@ -400,6 +737,7 @@ public:
 
 	/**
 	 * Counts all the nodes in subtree
+	 * The count is cached, so this function does not traverse the subtree
 	 * @return node count
 	 */
 	int getNodeCount();
@@ -424,13 +762,22 @@ class fS_Genotype
 
 	friend class GenoOper_fS;
 
+	friend class fS_BinaryCodec;
+
 private:
+	/// Create a genotype without nodes; the caller must set startNode
+	fS_Genotype() {}
+
+	/// Get the genotype params that are used when the genotype does not specify them
+	static GenotypeParams getDefaultGenotypeParams();
+
 	/**
 	 * Draws a node that has an index greater that specified
+	 * @param rng the random generator to draw from
 	 * @param fromIndex minimal index of the node
 	 * @return pointer to drawn node
 	 */
-	Node *chooseNode(int fromIndex=0);
+	Node *chooseNode(RandomGenerator &rng, int fromIndex=0);
 
 	/**
 	 * Draws a value from defined distribution
@@ -444,11 +791,74 @@ private:
 	 */
 	Node *getNearestNode(vector<Node *> allNodes, Node *node);
 
+	int nextNeuronId = 0;	/// The identifier that will be given to the next added neuron
+
+	/**
+	 * Give the neurons the identifiers equal to their positions, and the next added neuron the following one
+	 * Identifiers of removed neurons are not reused, so this keeps getNeuronPositions() proportional to the number of
+	 * neurons in a genotype that is edited many times. Must not be called while edits are recorded, as they refer
+	 * to the old identifiers.
+	 * @param allNeurons all the neurons of the genotype, as returned by getAllNeurons()
+	 */
+	void compactNeuronIds(const vector<fS_Neuron *> &allNeurons);
+
+	/**
+	 * A recorded edit of the genotype
+	 * undo reverts the edit; release frees the objects that the edit removed from the tree, once it is committed
+	 */
+	struct Edit
+	{
+		Node *changedNode;	/// The node whose own properties were edited, or null if the edit changed the structure
+		std::function<void()> undo;
+		std::function<void()> release;
+	};
+	vector<Edit> editLog;	/// Edits made since the outermost beginEdits()
+	int editDepth = 0;	/// The number of beginEdits() calls that were not committed or rolled back yet
+
+	/**
+	 * Record an edit that was just applied to the genotype
+	 * If no edits are being recorded, the edit is permanent and release is called immediately
+	 * @param changedNode the node whose own properties were edited, or null if the edit changed the structure
+	 */
+	void recordEdit(Node *changedNode, std::function<void()> undo, std::function<void()> release = nullptr);
+
+	/// Add the node to changedNodes, or set structureChanged if the node is null
+	void markChanged(Node *changedNode);
+
+	/**
+	 * The nodes whose joint, modifiers, part type or params were changed by the editing methods since the model was built.
+	 * Edits of the tree or the neurons set structureChanged instead; the nodes may then be already freed.
+	 */
+	std::set<Node *> changedNodes;
+	bool structureChanged = false;	/// True if nodes or neurons were added, removed or changed since the model was built
+
+	void clearChanges()
+	{
+		changedNodes.clear();
+		structureChanged = false;
+	}
+
+	/**
+	 * Add the part, the joint and the neurons of a development step to the model
+	 * @param build collects the mappings of the added elements if build.buildMapping is set
+	 */
+	static void addStep(Model &model, const fS_DevelopmentStep &step, fS_ModelBuild &build);
+
+	/**
+	 * Add the elements of the first stepCount steps of the log to the model
+	 * If the model uses checkpoints, a checkpoint is made after every step.
+	 */
+	static void addSteps(Model &model, const vector<fS_DevelopmentStep> &developmentLog, int stepCount, fS_ModelBuild &build);
+
 public:
 	Node *startNode = nullptr;    /// The start (root) node. All other nodes are its descendants
 
 
-	static int precision; /// Number of decimal places for numbers in genotype
+	static std::atomic<int> precision; /// Number of decimal places for numbers in genotype
+
+	long stateCalculations = 0;	/// The number of getState() calls, counted for operator statistics
+	long distanceEvaluations = 0;	/// The number of distances between parts calculated by getState()
+	fS_ConversionTimes *conversionTimes = nullptr;	/// If not null, getState() and buildModel() add the time of their stages to it
 
 	/**
 	 * Build internal representation from fS format
@@ -467,6 +877,12 @@ public:
 	 */
 	vector<Node *> getAllNodes();
 
+	/**
+	 * Group all existing nodes by the sizes of subtrees that start in them
+	 * @return map from subtree size to the vector of nodes with such subtree size
+	 */
+	std::map<int, vector<Node *>> getNodesBySubtreeSize();
+
 	/**
 	 * Get all the neurons from the subtree that starts in given node
 	 * @param node The beginning of subtree
@@ -475,21 +891,76 @@ public:
 	static vector<fS_Neuron *> extractNeurons(Node *node);
 
 	/**
-	 * Get the index of the neuron in vector of neurons
-	 * @param neurons
-	 * @param changedNeuron
-	 * @return
+	 * Give the neuron a new identifier, unique in this genotype
+	 * Must be called for every neuron that is added to the genotype
+	 * @param neuron the added neuron
+	 */
+	void assignNeuronId(fS_Neuron *neuron);
+
+	/**
+	 * Remove all the connections that lead from the given neurons to any neuron of the genotype
+	 * Should be called before the given neurons are removed from the genotype
+	 * @param neurons the neurons that will be removed
 	 */
-	static int getNeuronIndex(vector<fS_Neuron *> neurons, fS_Neuron *changedNeuron);
+	void removeConnectionsFrom(const vector<fS_Neuron *> &neurons);
 
 	/**
-	 * Left- or right- shift the indexes of neuro connections by the given range
-	 * @param neurons
-	 * @param start The beginning of the range
-	 * @param end The end of the range
-	 * @param shift
+	 * Start recording edits, so that they can be rolled back
+	 * Edits are recorded only when they are made with the editing methods of fS_Genotype.
+	 * Calls may be nested; an inner commit keeps the edits, so that the outer rollback can still revert them.
+	 * @return the mark that rollbackEdits() returns to
 	 */
-	static void shiftNeuroConnections(vector<fS_Neuron *> &neurons, int start, int end, SHIFT shift);
+	int beginEdits();
+
+	/**
+	 * Accept the edits made since the matching beginEdits()
+	 * When the outermost recording is committed, the objects removed from the tree are freed.
+	 */
+	void commitEdits();
+
+	/**
+	 * Revert the edits made since the matching beginEdits(), in reverse order
+	 * @param mark the value returned by the matching beginEdits()
+	 */
+	void rollbackEdits(int mark);
+
+	/** @name Editing methods that record the changes, so that they can be rolled back */
+	//@{
+	void setParam(Node *node, const string &key, double value);
+
+	void removeParam(Node *node, const string &key);
+
+	void setModifier(Node *node, char modifier, int count);
+
+	void setJoint(Node *node, char joint);
+
+	void setPartShape(Node *node, Part::Shape partShape);
+
+	/// Must be called before the inputs of the neuron are changed
+	void saveNeuronInputs(fS_Neuron *neuron);
+
+	/// Must be called before the details (class and properties) of the neuron are changed
+	void saveNeuronDetails(fS_Neuron *neuron);
+
+	/// Add the neuron at the end of the node's neurons and give it an identifier
+	void addNeuron(Node *node, fS_Neuron *neuron);
+
+	/// Remove the neuron and all the connections from it; the order of the remaining neurons is kept
+	void removeNeuron(Node *node, int index);
+
+	/// Add the node at the end of parent's children
+	void addChild(Node *parent, Node *child);
+
+	/// Remove the child; the last child of the parent takes its place
+	void removeChild(Node *parent, int index);
+	//@}
+
+	/**
+	 * Get the positions of all neurons, i.e., their indexes in the fS and f0 representation
+	 * When no edits are recorded and most identifiers belong to removed neurons, the identifiers are compacted first.
+	 * @return vector that maps neuron identifiers to neuron positions
+	 */
+	vector<int> getNeuronPositions();
 
 	/**
 	 * Get all existing neurons
@@ -518,6 +989,76 @@ public:
 	 */
 	Model buildModel(bool using_checkpoints);
 
+	/**
+	 * Builds Model object from internal representation in a model owned by the caller
+	 * @param model the model to build; its previous contents are removed
+	 * @param buildMapping whether the model elements get the ranges of genotype they come from
+	 */
+	void buildModel(Model &model, bool using_checkpoints, bool buildMapping = true);
+
+	/**
+	 * Builds Model object and records how it developed
+	 * The states of nodes are calculated once, and the model is built from the recorded steps. Without checkpoints,
+	 * a checkpoint model of any step can then be built on demand with buildCheckpoint(), which is much cheaper
+	 * than the copy of the whole model that Model::checkpoint() stores after every part.
+	 * With using_checkpoints, the model still stores such a copy after every part, because the users of checkpoints
+	 * read them from the model; so the converter, which builds checkpoints this way, is not made faster by the log.
+	 * The log refers to the nodes of this genotype, so it is valid until the genotype is changed or destroyed.
+	 * @param model the model to build; its previous contents are removed
+	 * @param developmentLog filled with one step per part, in the order of building
+	 */
+	void buildModel(Model &model, vector<fS_DevelopmentStep> &developmentLog, bool using_checkpoints = false, bool buildMapping = true);
+
+	/**
+	 * Build the model as it was after the given step of development, without calculating the states of nodes
+	 * The result is the same as the checkpoint of that step created by buildModel(model, true):
+	 * the parts, joints and neurons of the first step+1 parts, without neural connections.
+	 * @param model the model to build; its previous contents are removed
+	 * @param developmentLog the log recorded by buildModel() since the last change of this genotype
+	 * @param step the index of the step, 0 ... getNodeCount()-1
+	 */
+	static void buildCheckpoint(Model &model, const vector<fS_DevelopmentStep> &developmentLog, int step);
+
+	/**
+	 * Update the model built from this genotype after edits, instead of building it again
+	 * When only the joint, modifiers, part type or params of some nodes were changed with the editing methods,
+	 * the states of these nodes and their descendants are calculated again, and their parts and joints are changed in place.
+	 * Other parts, joints and neurons, as well as the mapping, are left as they were.
+	 * If the tree or the neurons were edited, or the model does not match the genotype, the model is built again without the mapping.
+	 * @param model the model built from this genotype with buildModel() before the edits
+	 * @return true if the model was updated in place, false if it was built again
+	 */
+	bool updateModel(Model &model);
+
+	/**
+	 * Check if the other genotype provably builds the same model as this one
+	 * The trees must have the same shape, and the corresponding nodes the same effective properties and neurons.
+	 * The check does not calculate the states, so it is much cheaper than building and comparing the models.
+	 * @return true if the models are the same; false if they may differ
+	 */
+	bool hasSamePhenotype(fS_Genotype &other);
+
+	/**
+	 * Get the structural hash of the genotype
+	 * Combines the hash of the start node with the genotype params and the connections between neurons.
+	 * Genotypes with equal fS representations have equal hashes.
+	 * @return the 64-bit hash
+	 */
+	uint64_t getHash();
+
+	/**
+	 * Rewrite the genotype in the canonical form, shared by the different ways of writing the same phenotype
+	 * - params equal to their default values at the genotype precision are removed,
+	 * - modifiers are removed if the modifier multiplier is 1 (opposite modifiers already cancel out when parsed),
+	 * - the joint of the start node, which is never built, is set to the default one,
+	 * - the children of every node are sorted by their hashes, as the order of branches changes only the order
+	 *   of parts and neurons in the model.
+	 * Subtrees that differ only in their connections have equal hashes and keep their order, and so do the neurons
+	 * of a node, so some equivalent genotypes still have different canonical forms.
+	 * The changes are made with the editing methods, so they can be rolled back.
+	 */
+	void canonicalize();
+
 	/**
 	 * Adds neuro connections to model
 	 * @param a reference to a model where the connections will be added
@@ -529,11 +1070,6 @@ public:
 	 */
 	SString getGeno();
 
-	/**
-	 * After creating or deleting a new neuron, rearrange other neurons so that the inputs match
-	 */
-	void rearrangeNeuronConnections(fS_Neuron *newNeuron, SHIFT shift);
-
 };
 
 
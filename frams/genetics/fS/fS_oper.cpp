@@ -10,7 +10,7 @@
 #define FIELDSTRUCT GenoOper_fS
 static ParamEntry genooper_fS_paramtab[] =
 		{
-				{"Genetics: fS",            1, FS_OPCOUNT + 5,},
+				{"Genetics: fS",            1, FS_OPCOUNT + 9,},
 				{"fS_mut_add_part",         0, 0, "Add part",                    "f 0 100 10", FIELD(prob[FS_ADD_PART]),             "mutation: probability of adding a part",},
 				{"fS_mut_rem_part",         0, 0, "Remove part",                 "f 0 100 10", FIELD(prob[FS_REM_PART]),             "mutation: probability of deleting a part",},
 				{"fS_mut_mod_part",         0, 0, "Modify part",                 "f 0 100 10", FIELD(prob[FS_MOD_PART]),             "mutation: probability of changing the part type",},
@@ -30,16 +30,278 @@ static ParamEntry genooper_fS_paramtab[] =
 				{"fS_use_cub",              0, 0, "Use cuboids in mutations",    "d 0 1 1",    FIELD(useCub),                        "Use cuboids in mutations"},
 				{"fS_use_cyl",              0, 0, "Use cylinders in mutations",  "d 0 1 1",    FIELD(useCyl),                        "Use cylinders in mutations"},
 				{"fS_mut_add_part_strong",  0, 0, "Strong add part mutation",    "d 0 1 1",    FIELD(strongAddPart),                 "Add part mutation will produce more parametrized parts"},
+				{"fS_mut_adaptive",         0, 0, "Adaptive mutation probabilities", "d 0 1 0", FIELD(adaptiveProbabilities), "Prefer the mutation types that succeed often and take little time on genotypes of similar size. The probabilities above remain the baseline: each of them is only scaled by a bounded factor. The factors depend on the measured time of mutations, so runs with the same seed are not reproducible in this mode."},
+				{"fS_stats",                0, PARAM_READONLY | PARAM_DONTSAVE, "Operator statistics", "s", GETONLY(stats), "One line per mutation type and one for crossover: name, attempts, successes, failures, retries, getState calls, distance evaluations, nanoseconds"},
+				{"fS_stats_mut_fail",       0, PARAM_READONLY | PARAM_DONTSAVE, "Failed mutations", "d", FIELD(mutationFailures), "The number of mutations that failed after all retries"},
+				{"fS_stats_reset",          0, PARAM_DONTSAVE, "Reset statistics", "p()", PROCEDURE(p_resetstats), "Set all the operator statistics to zero"},
 		};
 
 #undef FIELDSTRUCT
 
+/// Names of the operators in statistics, in the order of mutation types and crossover
+static const char *OPERATOR_NAMES[FS_OPCOUNT + 1] = {
+		"add_part", "rem_part", "mod_part", "change_joint", "add_param", "rem_param", "mod_param", "mod_mod",
+		"add_neuro", "rem_neuro", "mod_neuro_conn", "add_neuro_conn", "rem_neuro_conn", "mod_neuro_params", "crossover"
+};
+
+fS_OperatorProbe::fS_OperatorProbe(const fS_Genotype *geno)
+{
+	stateCalculations = geno != nullptr ? geno->stateCalculations : 0;
+	distanceEvaluations = geno != nullptr ? geno->distanceEvaluations : 0;
+	start = std::chrono::steady_clock::now();
+}
+
+double fS_OperatorProbe::finish(fS_OperatorStats &stats, bool success, const fS_Genotype *geno0, const fS_Genotype *geno1)
+{
+	double nanoseconds = fS_elapsedNanoseconds(start);
+	stats.nanoseconds += nanoseconds;
+	stats.attempts++;
+	if (success)
+		stats.successes++;
+	else
+		stats.failures++;
+	const fS_Genotype *genotypes[] = {geno0, geno1};
+	for (int i = 0; i < 2; i++)
+	{
+		if (genotypes[i] != nullptr)
+		{
+			stats.stateCalculations += genotypes[i]->stateCalculations;
+			stats.distanceEvaluations += genotypes[i]->distanceEvaluations;
+		}
+	}
+	stats.stateCalculations -= stateCalculations;
+	stats.distanceEvaluations -= distanceEvaluations;
+	return nanoseconds;
+}
+
 GenoOper_fS::GenoOper_fS()
 {
 	par.setParamTab(genooper_fS_paramtab);
 	par.select(this);
 	par.setDefault();
 	supported_format = 'S';
+	randomGenerator = nullptr;
+	adaptiveObservations = nullptr;
+	resetStats();
+	resetAdaptive();
+}
+
+void GenoOper_fS::setRandomGenerator(RandomGenerator *generator)
+{
+	randomGenerator = generator;
+}
+
+RandomGenerator &GenoOper_fS::getRandomGenerator()
+{
+	return randomGenerator != nullptr ? *randomGenerator : RndGen;
+}
+
+int GenoOper_fS::roulette(const double *probtab, const int count)
+{
+	double sum = 0;
+	for (int i = 0; i < count; i++)
+		sum += probtab[i];
+	double selected = getRandomGenerator().Uni(0, sum);
+	sum = 0;
+	for (int i = 0; i < count; i++)
+	{
+		sum += probtab[i];
+		if (selected < sum)
+			return i;
+	}
+	return -1;
+}
+
+double GenoOper_fS::mutateCreep(char type, double current, double min, double max, double stddev, bool limit_precision_3digits)
+{
+	if (randomGenerator == nullptr)
+		return GenoOperators::mutateCreep(type, current, min, max, stddev, limit_precision_3digits);
+	double result = randomGenerator->Gauss(current, stddev);
+	if (result < min || result > max)
+	{
+		// Reflect the value, and wrap it in case it went so far that the reflection exceeded the other boundary
+		if (result > max)
+			result = max - (result - max);
+		else if (result < min)
+			result = min + (min - result);
+		if (result > max)
+			result = min + fmod(result - max, max - min);
+		else if (result < min)
+			result = min + fmod(min - result, max - min);
+	}
+	if (limit_precision_3digits)
+		result = floor(result * 1000 + 0.5) / 1000.0;
+	if (type == 'd')
+	{
+		result = int(result + 0.5);
+		if (result == current)
+			result += randomUint(*randomGenerator, 2) * 2 - 1;	// Force some change
+	}
+	return std::max(min, std::min(max, result));
+}
+
+double GenoOper_fS::mutateCreep(char type, double current, double min, double max, bool limit_precision_3digits)
+{
+	return mutateCreep(type, current, min, max, (max - min) / 2 / 5, limit_precision_3digits);
+}
+
+double GenoOper_fS::mutateCreepNoLimit(char type, double current, double stddev, bool limit_precision_3digits)
+{
+	double result = getRandomGenerator().Gauss(current, stddev);
+	if (limit_precision_3digits)
+		result = floor(result * 1000 + 0.5) / 1000.0;
+	if (type == 'd')
+	{
+		result = int(result + 0.5);
+		if (result == current)
+			result += randomUint(getRandomGenerator(), 2) * 2 - 1;
+	}
+	return result;
+}
+
+NeuroClass *GenoOper_fS::getRandomNeuroClass()
+{
+	if (randomGenerator == nullptr)
+		return GenoOperators::getRandomNeuroClass(Model::SHAPETYPE_SOLIDS);
+	vector<NeuroClass *> classes;
+	for (int i = 0; i < Neuro::getClassCount(); i++)
+	{
+		NeuroClass *neuroClass = Neuro::getClass(i);
+		if (neuroClass->genactive && neuroClass->isShapeTypeSupported(Model::SHAPETYPE_SOLIDS))
+			classes.push_back(neuroClass);
+	}
+	if (classes.empty())
+		return nullptr;
+	return classes[randomUint(*randomGenerator, classes.size())];
+}
+
+double GenoOper_fS::getMutatedNeuronConnectionWeight(double current)
+{
+	if (randomGenerator == nullptr)
+		return GenoOperators::getMutatedNeuronConnectionWeight(current);
+	return mutateCreepNoLimit('f', current, 2, true);
+}
+
+bool GenoOper_fS::mutateRandomNeuroClassProperty(fS_Neuron *neuron)
+{
+	if (randomGenerator == nullptr)
+		return GenoOperators::mutateRandomNeuroClassProperty(neuron);
+	int extraCount = neuron->extraProperties().getPropCount();
+	int classCount = neuron->getClass() != nullptr ? neuron->getClass()->getProperties().getPropCount() : 0;
+	if (extraCount + classCount == 0)
+		return false;
+	int index = randomUint(*randomGenerator, extraCount + classCount);
+	if (index < extraCount)
+	{
+		Param properties = neuron->extraProperties();
+		return mutateProperty(properties, index);
+	}
+	SyntParam properties = neuron->classProperties();	// The changes are written to the neuron details when it is destroyed
+	return mutateProperty(properties, index - extraCount);
+}
+
+bool GenoOper_fS::mutateProperty(ParamInterface &properties, int index)
+{
+	char type = properties.type(index)[0];
+	if ((properties.flags(index) & PARAM_READONLY) || (type != 'f' && type != 'd'))
+		return false;
+	double min, max, def;
+	getMinMaxDef(&properties, index, min, max, def);
+	double current = properties.getDouble(index);
+	double value = mutateCreep(type, current, min, max, true);
+	if (type == 'd')
+		properties.setInt(index, paInt(value));
+	else
+		properties.setDouble(index, value);
+	return value != current;
+}
+
+void GenoOper_fS::resetStats()
+{
+	for (int i = 0; i <= FS_OPCOUNT; i++)
+		stats[i] = fS_OperatorStats();
+	mutationFailures = 0;
+}
+
+void GenoOper_fS::resetAdaptive()
+{
+	for (int i = 0; i < FS_SIZE_CLASSES; i++)
+		for (int j = 0; j < FS_OPCOUNT; j++)
+			adaptive[i][j] = fS_AdaptiveRecord();
+}
+
+int GenoOper_fS::getSizeClass(int partCount)
+{
+	int sizeClass = 0;
+	while (partCount > 1 && sizeClass < FS_SIZE_CLASSES - 1)
+	{
+		partCount /= 2;
+		sizeClass++;
+	}
+	return sizeClass;
+}
+
+void GenoOper_fS::getAdaptiveProbabilities(int sizeClass, double *result)
+{
+	const fS_AdaptiveRecord *records = adaptive[sizeClass];
+	double averageCost = 0;
+	int measured = 0;
+	for (int i = 0; i < FS_OPCOUNT; i++)
+	{
+		if (records[i].timedAttempts > 0)
+		{
+			averageCost += records[i].nanoseconds / records[i].timedAttempts;
+			measured++;
+		}
+	}
+	if (measured > 0)
+		averageCost /= measured;
+
+	for (int i = 0; i < FS_OPCOUNT; i++)
+	{
+		double factor = records[i].successes / records[i].attempts;
+		if (averageCost > 0 && records[i].timedAttempts > 0)
+		{
+			double cost = records[i].nanoseconds / records[i].timedAttempts;
+			factor *= averageCost / max(cost, averageCost * ADAPTIVE_MIN_FACTOR);
+		}
+		result[i] = prob[i] * min(max(factor, ADAPTIVE_MIN_FACTOR), ADAPTIVE_MAX_FACTOR);
+	}
+}
+
+void GenoOper_fS::updateAdaptive(int sizeClass, int method, bool success, double nanoseconds)
+{
+	fS_AdaptiveRecord &record = adaptive[sizeClass][method];
+	if (record.timedAttempts >= ADAPTIVE_WINDOW)
+	{
+		record.attempts *= 0.5;
+		record.successes *= 0.5;
+		record.nanoseconds *= 0.5;
+		record.timedAttempts *= 0.5;
+	}
+	record.attempts++;
+	if (success)
+		record.successes++;
+	record.nanoseconds += nanoseconds;
+	record.timedAttempts++;
+}
+
+void GenoOper_fS::get_stats(ExtValue *ret)
+{
+	SString result;
+	for (int i = 0; i <= FS_OPCOUNT; i++)
+	{
+		const fS_OperatorStats &s = stats[i];
+		result += SString::sprintf("%s %ld %ld %ld %ld %ld %ld %.0f\n", OPERATOR_NAMES[i], s.attempts, s.successes, s.failures,
+				s.retries, s.stateCalculations, s.distanceEvaluations, s.nanoseconds);
+	}
+	ret->setString(result);
+}
+
+void GenoOper_fS::p_resetstats(ExtValue *args, ExtValue *ret)
+{
+	resetStats();
+	ret->setEmpty();
 }
 
 int GenoOper_fS::checkValidity(const char *geno, const char *genoname)
@@ -65,6 +327,18 @@ int GenoOper_fS::checkValidity(const char *geno, const char *genoname)
 
 int GenoOper_fS::mutate(char *&geno, float &chg, int &method)
 {
+	return mutate(geno, chg, method, nullptr);
+}
+
+int GenoOper_fS::mutate(char *&geno, float &chg, int &method, bool &neutral)
+{
+	return mutate(geno, chg, method, &neutral);
+}
+
+int GenoOper_fS::mutate(char *&geno, float &chg, int &method, bool *neutral)
+{
+	if (neutral != nullptr)
+		*neutral = false;
 	try
 	{
 		fS_Genotype genotype(geno);
@@ -78,96 +352,156 @@ int GenoOper_fS::mutate(char *&geno, float &chg, int &method)
 		if (useCyl)
 			availablePartShapes.push_back(Part::Shape::SHAPE_CYLINDER);
 
-		// Select a mutation
-		bool result = false;
-		method = GenoOperators::roulette(prob, FS_OPCOUNT);
-		switch (method)
-		{
-			case FS_ADD_PART:
-				result = addPart(genotype, availablePartShapes);
-				break;
-			case FS_REM_PART:
-				result = removePart(genotype);
-				break;
-			case FS_MOD_PART:
-				result = changePartType(genotype, availablePartShapes);
-				break;
-			case FS_CHANGE_JOINT:
-				result = changeJoint(genotype);
-				break;
-			case FS_ADD_PARAM:
-				result = addParam(genotype);
-				break;
-			case FS_REM_PARAM:
-				result = removeParam(genotype);
-				break;
-			case FS_MOD_PARAM:
-				result = changeParam(genotype);
-				break;
-			case FS_MOD_MOD:
-				result = changeModifier(genotype);
-				break;
-			case FS_ADD_NEURO:
-				result = addNeuro(genotype);
-				break;
-			case FS_REM_NEURO:
-				result = removeNeuro(genotype);
-				break;
-			case FS_MOD_NEURO_CONNECTION:
-				result = changeNeuroConnection(genotype);
-				break;
-			case FS_ADD_NEURO_CONNECTION:
-				result = addNeuroConnection(genotype);
-				break;
-			case FS_REM_NEURO_CONNECTION:
-				result = removeNeuroConnection(genotype);
-				break;
-			case FS_MOD_NEURO_PARAMS:
-				result = changeNeuroParam(genotype);
-				break;
-		}
+		int sizeClass = adaptiveProbabilities ? getSizeClass(genotype.getNodeCount()) : 0;
+		double adaptiveProb[FS_OPCOUNT];
 
-		if (result)
+		// Try mutations on the same tree until one succeeds; the changes of the failed ones are rolled back
+		for (int i = 0; i < mutationTries; i++)
 		{
-			free(geno);
-			geno = strdup(genotype.getGeno().c_str());
-			return GENOPER_OK;
+			if (adaptiveProbabilities)
+			{
+				getAdaptiveProbabilities(sizeClass, adaptiveProb);
+				method = roulette(adaptiveProb, FS_OPCOUNT);
+			}
+			else
+				method = roulette(prob, FS_OPCOUNT);
+			if (method < 0)
+				break;
+			if (i > 0)
+				stats[method].retries++;
+			int mark = genotype.beginEdits();
+			fS_OperatorProbe probe(&genotype);
+			bool result;
+			try
+			{
+				result = performMutation(genotype, method, availablePartShapes);
+			}
+			catch (fS_Exception &e)
+			{
+				probe.finish(stats[method], false, &genotype);
+				throw;
+			}
+			double nanoseconds = probe.finish(stats[method], result, &genotype);
+			if (adaptiveProbabilities)
+			{
+				if (adaptiveObservations != nullptr)
+					adaptiveObservations->push_back({sizeClass, method, result, nanoseconds});
+				else
+					updateAdaptive(sizeClass, method, result, nanoseconds);
+			}
+			if (result)
+			{
+				genotype.commitEdits();
+				// Edits of the tree or the neurons are assumed to change the phenotype
+				if (neutral != nullptr && !genotype.structureChanged)
+				{
+					fS_Genotype parent(geno);
+					*neutral = parent.hasSamePhenotype(genotype);
+				}
+				free(geno);
+				geno = strdup(genotype.getGeno().c_str());
+				return GENOPER_OK;
+			}
+			genotype.rollbackEdits(mark);
 		}
+		mutationFailures++;
 		return GENOPER_OPFAIL;
 	}
 	catch (fS_Exception &e)
 	{
 		logPrintf("GenoOper_fS", "mutate", LOG_WARN, e.what());
+		mutationFailures++;
 		return GENOPER_OPFAIL;
 	}
 }
 
+bool GenoOper_fS::performMutation(fS_Genotype &geno, int method, const vector <Part::Shape> &availablePartShapes)
+{
+	switch (method)
+	{
+		case FS_ADD_PART:
+			return addPart(geno, availablePartShapes);
+		case FS_REM_PART:
+			return removePart(geno);
+		case FS_MOD_PART:
+			return changePartType(geno, availablePartShapes);
+		case FS_CHANGE_JOINT:
+			return changeJoint(geno);
+		case FS_ADD_PARAM:
+			return addParam(geno);
+		case FS_REM_PARAM:
+			return removeParam(geno);
+		case FS_MOD_PARAM:
+			return changeParam(geno);
+		case FS_MOD_MOD:
+			return changeModifier(geno);
+		case FS_ADD_NEURO:
+			return addNeuro(geno);
+		case FS_REM_NEURO:
+			return removeNeuro(geno);
+		case FS_MOD_NEURO_CONNECTION:
+			return changeNeuroConnection(geno);
+		case FS_ADD_NEURO_CONNECTION:
+			return addNeuroConnection(geno);
+		case FS_REM_NEURO_CONNECTION:
+			return removeNeuroConnection(geno);
+		case FS_MOD_NEURO_PARAMS:
+			return changeNeuroParam(geno);
+	}
+	return false;
+}
+
+double GenoOper_fS::findMostSimilarSize(const std::map<int, vector<Node *>> &nodesBySize, int size, const vector<Node *> *&bucket)
+{
+	// Only the nearest greater or equal size and the nearest smaller size can give the best quotient
+	auto it = nodesBySize.lower_bound(size);
+	double bestQuotient = DBL_MAX;
+	if (it != nodesBySize.end())
+	{
+		bestQuotient = double(it->first) / double(size);
+		bucket = &it->second;
+	}
+	if (it != nodesBySize.begin())
+	{
+		--it;
+		double quotient = double(size) / double(it->first);
+		if (quotient < bestQuotient)
+		{
+			bestQuotient = quotient;
+			bucket = &it->second;
+		}
+	}
+	return bestQuotient;
+}
+
 int GenoOper_fS::crossOver(char *&g0, char *&g1, float &chg0, float &chg1)
 {
+	assert(PARENT_COUNT == 2); // Cross over works only for 2 parents
+	fS_Genotype *parents[PARENT_COUNT] = {nullptr, nullptr};
+	fS_OperatorProbe probe;
 	try
 	{
-		assert(PARENT_COUNT == 2); // Cross over works only for 2 parents
-		fS_Genotype *parents[PARENT_COUNT] = {new fS_Genotype(g0), new fS_Genotype(g1)};
+		parents[0] = new fS_Genotype(g0);
+		parents[1] = new fS_Genotype(g1);
 
 		// Choose random subtrees that have similar size
 		Node *selected[PARENT_COUNT];
 		vector < Node * > allNodes0 = parents[0]->getAllNodes();
-		vector < Node * > allNodes1 = parents[1]->getAllNodes();
+		std::map<int, vector < Node * >> nodesBySize1 = parents[1]->getNodesBySubtreeSize();
 
 		double bestQuotient = DBL_MAX;
 		for (int i = 0; i < crossOverTries; i++)
 		{
-			Node *tmp0 = allNodes0[rndUint(allNodes0.size())];
-			Node *tmp1 = allNodes1[rndUint(allNodes1.size())];
+			Node *tmp0 = allNodes0[randomUint(getRandomGenerator(), allNodes0.size())];
+			// Find the most similar subtree size in the second parent
+			const vector < Node * > *bucket1;
+			double quotient = findMostSimilarSize(nodesBySize1, tmp0->getNodeCount(), bucket1);
 			// Choose this pair if it is the most similar
-			double quotient = double(tmp0->getNodeCount()) / double(tmp1->getNodeCount());
-			if (quotient < 1.0)
-				quotient = 1.0 / quotient;
 			if (quotient < bestQuotient)
 			{
 				bestQuotient = quotient;
 				selected[0] = tmp0;
-				selected[1] = tmp1;
+				selected[1] = (*bucket1)[randomUint(getRandomGenerator(), bucket1->size())];
 			}
 			if (bestQuotient == 1.0)
 				break;
@@ -185,9 +519,8 @@ int GenoOper_fS::crossOver(char *&g0, char *&g1, float &chg0, float &chg1)
 		chg1 = restSizes[1] / (restSizes[1] + subtreeSizes[0]);
 
 		// Rearrange neurons before crossover
-		int subOldStart[PARENT_COUNT] {-1, -1};
-		rearrangeConnectionsBeforeCrossover(parents[0], selected[0], subOldStart[0]);
-		rearrangeConnectionsBeforeCrossover(parents[1], selected[1], subOldStart[1]);
+		rearrangeConnectionsBeforeCrossover(parents[0], selected[0]);
+		rearrangeConnectionsBeforeCrossover(parents[1], selected[1]);
 
 		// Swap the subtress
 		for (int i = 0; i < PARENT_COUNT; i++)
@@ -198,28 +531,34 @@ int GenoOper_fS::crossOver(char *&g0, char *&g1, float &chg0, float &chg1)
 			{
 				size_t index = std::distance(p->children.begin(), std::find(p->children.begin(), p->children.end(), selected[i]));
 				p->children[index] = other;
+				p->changeSubtreeSize(other->subtreeSize - selected[i]->subtreeSize);
+				p->invalidateHash();
 			} else
 				parents[i]->startNode = other;
 		}
+		swap(selected[0]->parent, selected[1]->parent);
 
 		// Rearrange neurons after crossover
-		rearrangeConnectionsAfterCrossover(parents[0], selected[1], subOldStart[0]);
-		rearrangeConnectionsAfterCrossover(parents[1], selected[0], subOldStart[1]);
+		rearrangeConnectionsAfterCrossover(parents[0], selected[1]);
+		rearrangeConnectionsAfterCrossover(parents[1], selected[0]);
 
 		// Clenup, assign children to result strings
 		free(g0);
 		free(g1);
 		g0 = strdup(parents[0]->getGeno().c_str());
 		g1 = strdup(parents[1]->getGeno().c_str());
-
-		delete parents[0];
-		delete parents[1];
 	}
 	catch (fS_Exception &e)
 	{
 		logPrintf("GenoOper_fS", "crossOver", LOG_WARN, e.what());
+		probe.finish(stats[FS_STATS_CROSSOVER], false, parents[0], parents[1]);
+		delete parents[0];
+		delete parents[1];
 		return GENOPER_OPFAIL;
 	}
+	probe.finish(stats[FS_STATS_CROSSOVER], true, parents[0], parents[1]);
+	delete parents[0];
+	delete parents[1];
 	return GENOPER_OK;
 }
 
@@ -228,6 +567,203 @@ const char *GenoOper_fS::getSimplest()
 	return "1.1,0,0.4:C{x=0.80599;y=0.80599;z=0.80599}";
 }
 
+void GenoOper_fS::copySettings(const GenoOper_fS &source)
+{
+	for (int i = 0; i < FS_OPCOUNT; i++)
+		prob[i] = source.prob[i];
+	ensureCircleSection = source.ensureCircleSection;
+	useElli = source.useElli;
+	useCub = source.useCub;
+	useCyl = source.useCyl;
+	strongAddPart = source.strongAddPart;
+	adaptiveProbabilities = source.adaptiveProbabilities;
+	for (int i = 0; i < FS_SIZE_CLASSES; i++)
+		for (int j = 0; j < FS_OPCOUNT; j++)
+			adaptive[i][j] = source.adaptive[i][j];
+}
+
+unsigned int GenoOper_fS::getTaskSeed(unsigned int seed, int task)
+{
+	// Mix the bits, so that the seeds of neighbouring tasks are not similar
+	uint32_t x = seed + 0x9E3779B9u * uint32_t(task + 1);
+	x ^= x >> 16;
+	x *= 0x85EBCA6Bu;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35u;
+	x ^= x >> 16;
+	return x;
+}
+
+/**
+ * The tasks of produceOffspring(), split into one contiguous range per worker
+ * A worker takes the tasks from the front of its own range and, when it runs out of them, steals from the back
+ * of the ranges of the other workers.
+ */
+class fS_TaskRanges
+{
+	struct Range
+	{
+		std::mutex lock;
+		int begin, end;
+	};
+	vector<Range> ranges;
+
+	int takeFront(Range &range)
+	{
+		std::lock_guard<std::mutex> guard(range.lock);
+		return range.begin < range.end ? range.begin++ : -1;
+	}
+
+	int takeBack(Range &range)
+	{
+		std::lock_guard<std::mutex> guard(range.lock);
+		return range.begin < range.end ? --range.end : -1;
+	}
+
+public:
+	fS_TaskRanges(int taskCount, int workerCount) : ranges(workerCount)
+	{
+		for (int i = 0; i < workerCount; i++)
+		{
+			ranges[i].begin = int(long(taskCount) * i / workerCount);
+			ranges[i].end = int(long(taskCount) * (i + 1) / workerCount);
+		}
+	}
+
+	/// @return the index of the next task for the worker, or -1 if all the tasks are taken
+	int next(int worker)
+	{
+		int task = takeFront(ranges[worker]);
+		for (int i = 1; task < 0 && i < int(ranges.size()); i++)
+			task = takeBack(ranges[(worker + i) % ranges.size()]);
+		return task;
+	}
+};
+
+fS_ThreadPool::~fS_ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	for (int i = 0; i < int(threads.size()); i++)
+		threads[i].join();
+}
+
+void fS_ThreadPool::work(int worker)
+{
+	int lastJob = 0;
+	std::unique_lock<std::mutex> guard(mutex);
+	while (true)
+	{
+		jobReady.wait(guard, [&]() { return stopping || jobNumber != lastJob; });
+		if (stopping)
+			return;
+		lastJob = jobNumber;
+		if (worker >= workerCount)
+			continue;
+		guard.unlock();
+		(*job)(worker);
+		guard.lock();
+		if (--busyThreads == 0)
+			jobDone.notify_one();
+	}
+}
+
+void fS_ThreadPool::run(int _workerCount, const std::function<void(int)> &_job)
+{
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		// A thread started here waits for the lock, so it sees the new job number and takes part in this job
+		while (int(threads.size()) < _workerCount - 1)
+			threads.push_back(std::thread(&fS_ThreadPool::work, this, int(threads.size()) + 1));
+		job = &_job;
+		workerCount = _workerCount;
+		busyThreads = _workerCount - 1;
+		jobNumber++;
+	}
+	jobReady.notify_all();
+	_job(0);
+	std::unique_lock<std::mutex> guard(mutex);
+	jobDone.wait(guard, [&]() { return busyThreads == 0; });
+	job = nullptr;
+}
+
+vector<fS_Offspring> GenoOper_fS::produceOffspring(const vector<string> &parents, const vector<fS_OffspringTask> &plan, unsigned int seed, int threadCount)
+{
+	vector<fS_Offspring> offspring(plan.size());
+	if (threadCount <= 0)
+		threadCount = max(1, int(std::thread::hardware_concurrency()));
+	threadCount = max(1, min(threadCount, int(plan.size())));
+
+	fS_TaskRanges tasks(plan.size(), threadCount);
+	vector<GenoOper_fS> workers(threadCount);
+	vector<vector<fS_AdaptiveObservation>> observations(plan.size());
+	std::function<void(int)> work = [&](int worker)
+	{
+		GenoOper_fS &operators = workers[worker];
+		operators.copySettings(*this);
+		RandomGenerator generator(seed);
+		operators.setRandomGenerator(&generator);
+		for (int task = tasks.next(worker); task >= 0; task = tasks.next(worker))
+		{
+			const fS_OffspringTask &t = plan[task];
+			fS_Offspring &result = offspring[task];
+			assert(t.parent0 >= 0 && t.parent0 < int(parents.size()) && t.parent1 < int(parents.size()));
+			generator.setSeed(getTaskSeed(seed, task));
+			// The learned state of the worker stays as copied, so every task starts from the same one
+			operators.adaptiveObservations = &observations[task];
+
+			char *g0 = strdup(parents[t.parent0].c_str());
+			if (t.parent1 < 0)
+			{
+				result.result = operators.mutate(g0, result.chg[0], result.method, result.neutral);
+			}
+			else
+			{
+				char *g1 = strdup(parents[t.parent1].c_str());
+				result.result = operators.crossOver(g0, g1, result.chg[0], result.chg[1]);
+				result.method = FS_STATS_CROSSOVER;
+				result.genotypes[1] = g1;
+				free(g1);
+			}
+			result.genotypes[0] = g0;
+			free(g0);
+		}
+	};
+
+	if (threadCount == 1)
+		work(0);
+	else
+	{
+		if (!threadPool)
+			threadPool.reset(new fS_ThreadPool());
+		threadPool->run(threadCount, work);
+	}
+
+	for (int i = 0; i < threadCount; i++)
+	{
+		for (int j = 0; j <= FS_OPCOUNT; j++)
+		{
+			const fS_OperatorStats &from = workers[i].stats[j];
+			fS_OperatorStats &to = stats[j];
+			to.attempts += from.attempts;
+			to.successes += from.successes;
+			to.failures += from.failures;
+			to.retries += from.retries;
+			to.stateCalculations += from.stateCalculations;
+			to.distanceEvaluations += from.distanceEvaluations;
+			to.nanoseconds += from.nanoseconds;
+		}
+		mutationFailures += workers[i].mutationFailures;
+	}
+	for (int task = 0; task < int(plan.size()); task++)
+		for (const fS_AdaptiveObservation &o : observations[task])
+			updateAdaptive(o.sizeClass, o.method, o.success, o.nanoseconds);
+	return offspring;
+}
+
 uint32_t GenoOper_fS::style(const char *geno, int pos)
 {
 	char ch = geno[pos];
@@ -252,51 +788,29 @@ uint32_t GenoOper_fS::style(const char *geno, int pos)
 	return style;
 }
 
-void GenoOper_fS::rearrangeConnectionsBeforeCrossover(fS_Genotype *geno, Node *sub, int &subStart)
+void GenoOper_fS::rearrangeConnectionsBeforeCrossover(fS_Genotype *geno, Node *sub)
 {
-	vector < fS_Neuron * > genoNeurons = geno->getAllNeurons();
-	vector < fS_Neuron * > subNeurons = fS_Genotype::extractNeurons(sub);
-
-	if (!subNeurons.empty())
-	{
-		subStart = fS_Genotype::getNeuronIndex(genoNeurons, subNeurons[0]);
-		fS_Genotype::shiftNeuroConnections(genoNeurons, subStart, subStart + subNeurons.size() - 1, SHIFT::LEFT);
-	}
+	geno->removeConnectionsFrom(fS_Genotype::extractNeurons(sub));
 }
 
-void GenoOper_fS::rearrangeConnectionsAfterCrossover(fS_Genotype *geno, Node *sub, int subOldStart)
+void GenoOper_fS::rearrangeConnectionsAfterCrossover(fS_Genotype *geno, Node *sub)
 {
-	vector < fS_Neuron * > genoNeurons = geno->getAllNeurons();
 	vector < fS_Neuron * > subNeurons = fS_Genotype::extractNeurons(sub);
 
-	// Shift the inputs right
-	if (!subNeurons.empty())
+	// Identifiers from the other genotype are meaningless here
+	for (int i = 0; i < int(subNeurons.size()); i++)
 	{
-		int subStart = fS_Genotype::getNeuronIndex(genoNeurons, subNeurons[0]);
-		int subCount = subNeurons.size();
-		int subEnd = subStart + subCount - 1;
-		for (int i = 0; i < subCount; i++)
-		{
-			auto inputs = subNeurons[i]->inputs;
-			std::map<int, double> newInputs;
-			// TODO figure out how to keep internal connections in subtree
-//			for (auto it = inputs.begin(); it != inputs.end(); ++it)
-//			{
-//				int newIndex = it->first + subStart;
-//				if(subEnd > newIndex && newIndex > subStart)
-//					newInputs[newIndex] = it->second;
-//			}
-			subNeurons[i]->inputs = newInputs;
-		}
-		fS_Genotype::shiftNeuroConnections(genoNeurons, subStart, subEnd, SHIFT::RIGHT);
+		// TODO figure out how to keep internal connections in subtree
+		subNeurons[i]->inputs.clear();
+		geno->assignNeuronId(subNeurons[i]);
 	}
 }
 
 bool GenoOper_fS::addPart(fS_Genotype &geno, const vector <Part::Shape> &availablePartShapes, bool mutateSize)
 {
 	geno.getState(false);
-	Node *node = geno.chooseNode();
-	char partShape = SHAPE_TO_GENE.at(availablePartShapes[rndUint(availablePartShapes.size())]);
+	Node *node = geno.chooseNode(getRandomGenerator());
+	char partShape = SHAPE_TO_GENE.at(availablePartShapes[randomUint(getRandomGenerator(), availablePartShapes.size())]);
 
 	Substring substring(&partShape, 0, 1);
 	Node *newNode = new Node(substring, node, node->genotypeParams);
@@ -305,21 +819,21 @@ bool GenoOper_fS::addPart(fS_Genotype &geno, const vector <Part::Shape> &availab
 	if (strongAddPart)
 	{
 		for (int i = 0; i < 3; i++)
-			newNode->params[rotationParams[i]] = RndGen.Uni(-M_PI / 2, M_PI / 2);
+			newNode->params[rotationParams[i]] = getRandomGenerator().Uni(-M_PI / 2, M_PI / 2);
 	} else
 	{
-		string selectedParam = rotationParams[rndUint(3)];
-		newNode->params[selectedParam] = RndGen.Uni(-M_PI / 2, M_PI / 2);
+		string selectedParam = rotationParams[randomUint(getRandomGenerator(), 3)];
+		newNode->params[selectedParam] = getRandomGenerator().Uni(-M_PI / 2, M_PI / 2);
 	}
 	string rParams[] {RX, RY, RZ};
 	if (strongAddPart)
 	{
 		for (int i = 0; i < 3; i++)
-			newNode->params[rParams[i]] = RndGen.Uni(-M_PI / 2, M_PI / 2);
+			newNode->params[rParams[i]] = getRandomGenerator().Uni(-M_PI / 2, M_PI / 2);
 	} else
 	{
-		string selectedParam = rParams[rndUint(3)];
-		newNode->params[selectedParam] = RndGen.Uni(-M_PI / 2, M_PI / 2);
+		string selectedParam = rParams[randomUint(getRandomGenerator(), 3)];
+		newNode->params[selectedParam] = getRandomGenerator().Uni(-M_PI / 2, M_PI / 2);
 	}
 	// Assign part scale to default value
 	double volumeMultiplier = pow(node->getParam(SCALE) * node->state->s, 3);
@@ -333,14 +847,14 @@ bool GenoOper_fS::addPart(fS_Genotype &geno, const vector <Part::Shape> &availab
 	newNode->params[SCALE_X] = newRadius;
 	newNode->params[SCALE_Y] = newRadius;
 	newNode->params[SCALE_Z] = newRadius;
-	node->children.push_back(newNode);
+	geno.addChild(node, newNode);
 
 	if (mutateSize)
 	{
 		geno.getState(false);
-		mutateScaleParam(newNode, SCALE_X, true);
-		mutateScaleParam(newNode, SCALE_Y, true);
-		mutateScaleParam(newNode, SCALE_Z, true);
+		mutateScaleParam(geno, newNode, SCALE_X, true);
+		mutateScaleParam(geno, newNode, SCALE_Y, true);
+		mutateScaleParam(geno, newNode, SCALE_Z, true);
 	}
 	return true;
 }
@@ -352,19 +866,15 @@ bool GenoOper_fS::removePart(fS_Genotype &geno)
 	// It may be difficult to choose an eligible node, so the number of tries should be high
 	for (int i = 0; i < 10 * mutationTries; i++)
 	{
-		randomNode = geno.chooseNode();
+		randomNode = geno.chooseNode(getRandomGenerator());
 		int childCount = randomNode->children.size();
 		if (childCount > 0)
 		{
-			int selectedIndex = rndUint(childCount);
+			int selectedIndex = randomUint(getRandomGenerator(), childCount);
 			selectedChild = randomNode->children[selectedIndex];
 			if (selectedChild->children.empty() && selectedChild->neurons.empty())
 			{
-				// Remove the selected child
-				swap(randomNode->children[selectedIndex], randomNode->children[childCount - 1]);
-				randomNode->children.pop_back();
-				randomNode->children.shrink_to_fit();
-				delete selectedChild;
+				geno.removeChild(randomNode, selectedIndex);
 				return true;
 			}
 		}
@@ -377,10 +887,10 @@ bool GenoOper_fS::changePartType(fS_Genotype &geno, const vector <Part::Shape> &
 	int availShapesLen = availablePartShapes.size();
 	for (int i = 0; i < mutationTries; i++)
 	{
-		Node *randomNode = geno.chooseNode();
-		int index = rndUint(availShapesLen);
+		Node *randomNode = geno.chooseNode(getRandomGenerator());
+		int index = randomUint(getRandomGenerator(), availShapesLen);
 		if (availablePartShapes[index] == randomNode->partShape)
-			index = (index + 1 + rndUint(availShapesLen - 1)) % availShapesLen;
+			index = (index + 1 + randomUint(getRandomGenerator(), availShapesLen - 1)) % availShapesLen;
 		Part::Shape newType = availablePartShapes[index];
 
 #ifdef _DEBUG
@@ -395,26 +905,26 @@ bool GenoOper_fS::changePartType(fS_Genotype &geno, const vector <Part::Shape> &
 		if (!ensureCircleSection || newType == Part::Shape::SHAPE_CUBOID || (randomNode->partShape == Part::Shape::SHAPE_ELLIPSOID && newType == Part::Shape::SHAPE_CYLINDER))
 		{
 			double radiusQuotient = std::cbrt(volumeMultipliers.at(randomNode->partShape) / volumeMultipliers.at(newType));
-			randomNode->params[SCALE_X] = randomNode->getParam(SCALE_X) * radiusQuotient;
-			randomNode->params[SCALE_Y] = randomNode->getParam(SCALE_Y) * radiusQuotient;
-			randomNode->params[SCALE_Z] = randomNode->getParam(SCALE_Z) * radiusQuotient;
+			geno.setParam(randomNode, SCALE_X, randomNode->getParam(SCALE_X) * radiusQuotient);
+			geno.setParam(randomNode, SCALE_Y, randomNode->getParam(SCALE_Y) * radiusQuotient);
+			geno.setParam(randomNode, SCALE_Z, randomNode->getParam(SCALE_Z) * radiusQuotient);
 		} else if (randomNode->partShape == Part::Shape::SHAPE_CUBOID && newType == Part::Shape::SHAPE_CYLINDER)
 		{
 			double newRadius = 0.5 * (randomNode->getParam(SCALE_X) + randomNode->getParam(SCALE_Y));
-			randomNode->params[SCALE_X] = 0.5 * relativeVolume / (M_PI * newRadius * newRadius);
-			randomNode->params[SCALE_Y] = newRadius;
-			randomNode->params[SCALE_Z] = newRadius;
+			geno.setParam(randomNode, SCALE_X, 0.5 * relativeVolume / (M_PI * newRadius * newRadius));
+			geno.setParam(randomNode, SCALE_Y, newRadius);
+			geno.setParam(randomNode, SCALE_Z, newRadius);
 		} else if (newType == Part::Shape::SHAPE_ELLIPSOID)
 		{
 			double newRelativeRadius = cbrt(relativeVolume / volumeMultipliers.at(newType));
-			randomNode->params[SCALE_X] = newRelativeRadius;
-			randomNode->params[SCALE_Y] = newRelativeRadius;
-			randomNode->params[SCALE_Z] = newRelativeRadius;
+			geno.setParam(randomNode, SCALE_X, newRelativeRadius);
+			geno.setParam(randomNode, SCALE_Y, newRelativeRadius);
+			geno.setParam(randomNode, SCALE_Z, newRelativeRadius);
 		} else
 		{
 			throw fS_Exception("Invalid part type", 1);
 		}
-		randomNode->partShape = newType;
+		geno.setPartShape(randomNode, newType);
 		return true;
 	}
 	return false;
@@ -425,39 +935,49 @@ bool GenoOper_fS::changeJoint(fS_Genotype &geno)
 	if (geno.startNode->children.empty())
 		return false;
 
-	Node *randomNode = geno.chooseNode(1);        // First part does not have joints
+	Node *randomNode = geno.chooseNode(getRandomGenerator(), 1);        // First part does not have joints
 	int jointLen = ALL_JOINTS.length();
-	int index = rndUint(jointLen);
+	int index = randomUint(getRandomGenerator(), jointLen);
 	if (ALL_JOINTS[index] == randomNode->joint)
-		index = (index + 1 + rndUint(jointLen - 1)) % jointLen;
+		index = (index + 1 + randomUint(getRandomGenerator(), jointLen - 1)) % jointLen;
 
-	randomNode->joint = ALL_JOINTS[index];
+	geno.setJoint(randomNode, ALL_JOINTS[index]);
 	return true;
 }
 
+/**
+ * Check if the radius must stay equal to another radius of the part to keep its cross-section a circle
+ * @param partShape the shape of the part
+ * @param key the key of the param
+ * @return true if the param cannot be changed alone
+ */
+static bool isTiedRadius(Part::Shape partShape, const string &key)
+{
+	bool isRadiusOfBase = key == SCALE_Y || key == SCALE_Z;
+	bool isRadius = isRadiusOfBase || key == SCALE_X;
+	if (partShape == Part::Shape::SHAPE_ELLIPSOID)
+		return isRadius;
+	if (partShape == Part::Shape::SHAPE_CYLINDER)
+		return isRadiusOfBase;
+	return false;
+}
+
 bool GenoOper_fS::addParam(fS_Genotype &geno)
 {
-	Node *randomNode = geno.chooseNode();
+	Node *randomNode = geno.chooseNode(getRandomGenerator());
 	int paramCount = randomNode->params.size();
 	if (paramCount == int(PARAMS.size()))
 		return false;
-	string key = PARAMS[rndUint(PARAMS.size())];
+	string key = PARAMS[randomUint(getRandomGenerator(), PARAMS.size())];
 	if (randomNode->params.count(key) > 0)
 		return false;
 	// Do not allow invalid changes in part size
-	bool isRadiusOfBase = key == SCALE_Y || key == SCALE_Z;
-	bool isRadius = isRadiusOfBase || key == SCALE_X;
-	if (ensureCircleSection && isRadius)
-	{
-		if (randomNode->partShape == Part::Shape::SHAPE_ELLIPSOID)
-			return false;
-		if (randomNode->partShape == Part::Shape::SHAPE_CYLINDER && isRadiusOfBase)
-			return false;
-	}
+	if (ensureCircleSection && isTiedRadius(randomNode->partShape, key))
+		return false;
 	// Add modified default value for param
-	randomNode->params[key] = randomNode->defaultValues.at(key);
+	geno.setParam(randomNode, key, randomNode->defaultValues.at(key));
 	geno.getState(false);
-	return mutateParamValue(randomNode, key);
+	return mutateParamValue(geno, randomNode, key);
 }
 
 bool GenoOper_fS::removeParam(fS_Genotype &geno)
@@ -465,29 +985,29 @@ bool GenoOper_fS::removeParam(fS_Genotype &geno)
 	// Choose a node with params
 	for (int i = 0; i < mutationTries; i++)
 	{
-		Node *randomNode = geno.chooseNode();
+		Node *randomNode = geno.chooseNode(getRandomGenerator());
 		int paramCount = randomNode->params.size();
 		if (paramCount >= 1)
 		{
 			auto it = randomNode->params.begin();
-			advance(it, rndUint(paramCount));
+			advance(it, randomUint(getRandomGenerator(), paramCount));
 			string key = it->first;
-			double value = it->second;
 
-			randomNode->params.erase(key);
+			int mark = geno.beginEdits();
+			geno.removeParam(randomNode, key);
 			if(geno.checkValidityOfPartSizes() == 0)
-				return true;
-			else
 			{
-				randomNode->params[key] = value;
+				geno.commitEdits();
+				return true;
 			}
+			geno.rollbackEdits(mark);
 		}
 	}
 	return false;
 }
 
 
-bool GenoOper_fS::mutateParamValue(Node *node, string key)
+bool GenoOper_fS::mutateParamValue(fS_Genotype &geno, Node *node, string key)
 {
 	// Do not allow invalid changes in part scale
 	if (std::find(SCALE_PARAMS.begin(), SCALE_PARAMS.end(), key) == SCALE_PARAMS.end())
@@ -495,10 +1015,10 @@ bool GenoOper_fS::mutateParamValue(Node *node, string key)
 		double max = Node::maxValues.at(key);
 		double min = Node::minValues.at(key);
 		double stddev = (max - min) * node->genotypeParams.paramMutationStrength;
-		node->params[key] = GenoOperators::mutateCreep('f', node->getParam(key), min, max, stddev, true);
+		geno.setParam(node, key, mutateCreep('f', node->getParam(key), min, max, stddev, true));
 		return true;
 	} else
-		return mutateScaleParam(node, key, ensureCircleSection);
+		return mutateScaleParam(geno, node, key, ensureCircleSection);
 }
 
 bool GenoOper_fS::changeParam(fS_Genotype &geno)
@@ -506,13 +1026,13 @@ bool GenoOper_fS::changeParam(fS_Genotype &geno)
 	geno.getState(false);
 	for (int i = 0; i < mutationTries; i++)
 	{
-		Node *randomNode = geno.chooseNode();
+		Node *randomNode = geno.chooseNode(getRandomGenerator());
 		int paramCount = randomNode->params.size();
 		if (paramCount >= 1)
 		{
 			auto it = randomNode->params.begin();
-			advance(it, rndUint(paramCount));
-			return mutateParamValue(randomNode, it->first);
+			advance(it, randomUint(getRandomGenerator(), paramCount));
+			return mutateParamValue(geno, randomNode, it->first);
 		}
 	}
 	return false;
@@ -520,26 +1040,30 @@ bool GenoOper_fS::changeParam(fS_Genotype &geno)
 
 bool GenoOper_fS::changeModifier(fS_Genotype &geno)
 {
-	Node *randomNode = geno.chooseNode();
-	char randomModifier = MODIFIERS[rndUint(MODIFIERS.length())];
+	Node *randomNode = geno.chooseNode(getRandomGenerator());
+	char randomModifier = MODIFIERS[randomUint(getRandomGenerator(), MODIFIERS.length())];
 	int oldValue = randomNode->modifiers[randomModifier];
 
-	randomNode->modifiers[randomModifier] += rndUint(2) == 0 ? 1 : -1;
+	int mark = geno.beginEdits();
+	geno.setModifier(randomNode, randomModifier, oldValue + (randomUint(getRandomGenerator(), 2) == 0 ? 1 : -1));
 
 	bool isSizeMod = tolower(randomModifier) == SCALE_MODIFIER;
 	if (isSizeMod && geno.checkValidityOfPartSizes() != 0)
 	{
-		randomNode->modifiers[randomModifier] = oldValue;
+		geno.rollbackEdits(mark);
 		return false;
 	}
+	geno.commitEdits();
 	return true;
 }
 
 bool GenoOper_fS::addNeuro(fS_Genotype &geno)
 {
-	Node *randomNode = geno.chooseNode();
+	Node *randomNode = geno.chooseNode(getRandomGenerator());
 	fS_Neuron *newNeuron;
-	NeuroClass *rndclass = GenoOperators::getRandomNeuroClass(Model::SHAPETYPE_SOLIDS);
+	NeuroClass *rndclass = getRandomNeuroClass();
+	if (rndclass == nullptr)
+		return false;
 	if (rndclass->preflocation == NeuroClass::PREFER_JOINT && randomNode == geno.startNode)
 		return false;
 
@@ -554,41 +1078,33 @@ bool GenoOper_fS::addNeuro(fS_Genotype &geno)
 		for (int i = 0; i < int(allNeurons.size()); i++)
 		{
 			if (allNeurons[i]->getClass()->prefoutput > 0)
-				neuronsWithOutput.push_back(i);
+				neuronsWithOutput.push_back(allNeurons[i]->id);
 		}
 		int size = neuronsWithOutput.size();
 		if (size > 0)
 		{
 			for (int i = 0; i < effectiveInputCount; i++)
 			{
-				int selectedNeuron = neuronsWithOutput[rndUint(size)];
-				newNeuron->inputs[selectedNeuron] = DEFAULT_NEURO_CONNECTION_WEIGHT;
+				int selectedNeuron = neuronsWithOutput[randomUint(getRandomGenerator(), size)];
+				newNeuron->inputs.set(selectedNeuron, DEFAULT_NEURO_CONNECTION_WEIGHT);
 			}
 		}
 	}
 
-	randomNode->neurons.push_back(newNeuron);
-
-	geno.rearrangeNeuronConnections(newNeuron, SHIFT::RIGHT);
+	geno.addNeuron(randomNode, newNeuron);
 	return true;
 }
 
 bool GenoOper_fS::removeNeuro(fS_Genotype &geno)
 {
-	Node *randomNode = geno.chooseNode();
+	Node *randomNode = geno.chooseNode(getRandomGenerator());
 	for (int i = 0; i < mutationTries; i++)
 	{
-		randomNode = geno.chooseNode();
+		randomNode = geno.chooseNode(getRandomGenerator());
 		if (!randomNode->neurons.empty())
 		{
 			// Remove the selected neuron
-			int size = randomNode->neurons.size();
-			fS_Neuron *it = randomNode->neurons[rndUint(size)];
-			geno.rearrangeNeuronConnections(it, SHIFT::LEFT);        // Important to rearrange the neurons before deleting
-			swap(it, randomNode->neurons.back());
-			randomNode->neurons.pop_back();
-			randomNode->neurons.shrink_to_fit();
-			delete it;
+			geno.removeNeuron(randomNode, randomUint(getRandomGenerator(), randomNode->neurons.size()));
 			return true;
 		}
 	}
@@ -604,14 +1120,13 @@ bool GenoOper_fS::changeNeuroConnection(fS_Genotype &geno)
 	int size = neurons.size();
 	for (int i = 0; i < mutationTries; i++)
 	{
-		fS_Neuron *selectedNeuron = neurons[rndUint(size)];
+		fS_Neuron *selectedNeuron = neurons[randomUint(getRandomGenerator(), size)];
 		if (!selectedNeuron->inputs.empty())
 		{
-			int inputCount = selectedNeuron->inputs.size();
-			auto it = selectedNeuron->inputs.begin();
-			advance(it, rndUint(inputCount));
-
-			it->second = GenoOperators::getMutatedNeuronConnectionWeight(it->second);
+			int index = randomUint(getRandomGenerator(), selectedNeuron->inputs.size());
+			double weight = selectedNeuron->inputs.getWeight(index);
+			geno.saveNeuronInputs(selectedNeuron);
+			selectedNeuron->inputs.setWeight(index, getMutatedNeuronConnectionWeight(weight));
 			return true;
 		}
 	}
@@ -628,7 +1143,7 @@ bool GenoOper_fS::addNeuroConnection(fS_Genotype &geno)
 	fS_Neuron *selectedNeuron;
 	for (int i = 0; i < mutationTries; i++)
 	{
-		selectedNeuron = neurons[rndUint(size)];
+		selectedNeuron = neurons[randomUint(getRandomGenerator(), size)];
 		if (selectedNeuron->acceptsInputs())
 			break;
 	}
@@ -637,11 +1152,11 @@ bool GenoOper_fS::addNeuroConnection(fS_Genotype &geno)
 
 	for (int i = 0; i < mutationTries; i++)
 	{
-		int index = rndUint(size);
-		if (selectedNeuron->inputs.count(index) == 0 && neurons[index]->getClass()->getPreferredOutput() > 0)
+		fS_Neuron *inputNeuron = neurons[randomUint(getRandomGenerator(), size)];
+		if (!selectedNeuron->inputs.contains(inputNeuron->id) && inputNeuron->getClass()->getPreferredOutput() > 0)
 		{
-
-			selectedNeuron->inputs[index] = DEFAULT_NEURO_CONNECTION_WEIGHT;
+			geno.saveNeuronInputs(selectedNeuron);
+			selectedNeuron->inputs.set(inputNeuron->id, DEFAULT_NEURO_CONNECTION_WEIGHT);
 			return true;
 		}
 	}
@@ -657,13 +1172,11 @@ bool GenoOper_fS::removeNeuroConnection(fS_Genotype &geno)
 	int size = neurons.size();
 	for (int i = 0; i < mutationTries; i++)
 	{
-		fS_Neuron *selectedNeuron = neurons[rndUint(size)];
+		fS_Neuron *selectedNeuron = neurons[randomUint(getRandomGenerator(), size)];
 		if (!selectedNeuron->inputs.empty())
 		{
-			int inputCount = selectedNeuron->inputs.size();
-			auto it = selectedNeuron->inputs.begin();
-			advance(it, rndUint(inputCount));
-			selectedNeuron->inputs.erase(it->first);
+			geno.saveNeuronInputs(selectedNeuron);
+			selectedNeuron->inputs.removeAt(randomUint(getRandomGenerator(), selectedNeuron->inputs.size()));
 			return true;
 		}
 	}
@@ -676,37 +1189,70 @@ bool GenoOper_fS::changeNeuroParam(fS_Genotype &geno)
 	if (neurons.empty())
 		return false;
 
-	fS_Neuron *neu = neurons[rndUint(neurons.size())];
-	return GenoOperators::mutateRandomNeuroClassProperty(neu);
+	fS_Neuron *neu = neurons[randomUint(getRandomGenerator(), neurons.size())];
+	geno.saveNeuronDetails(neu);
+	return mutateRandomNeuroClassProperty(neu);
 }
 
-bool GenoOper_fS::mutateScaleParam(Node *node, string key, bool ensureCircleSection)
+bool GenoOper_fS::mutateScaleParam(fS_Genotype &geno, Node *node, string key, bool ensureCircleSection)
 {
+	// A radius that must stay equal to another one has no other feasible value
+	if (ensureCircleSection && isTiedRadius(node->partShape, key))
+		return false;
+
 	double oldValue = node->getParam(key);
 	double volume = node->calculateVolume();
-	double valueAtMinVolume, valueAtMaxVolume;
+	Pt3D scale;
+	node->calculateScale(scale);
+	const Part_MinMaxDef &minPart = Model::getMinPart();
+	const Part_MinMaxDef &maxPart = Model::getMaxPart();
+
+	// Find the interval of values for which the part is valid, so that no drawn value has to be rejected
+	double min = Node::minValues.at(key);
+	double max = Node::maxValues.at(key);
 	if(key == SCALE)
 	{
-		valueAtMinVolume = oldValue * std::cbrt(Model::getMinPart().volume / volume);
-		valueAtMaxVolume = oldValue * std::cbrt(Model::getMaxPart().volume / volume);
+		// All the radii change proportionally to the value, and the volume to its cube
+		min = std::max(min, oldValue * std::cbrt(minPart.volume / volume));
+		max = std::min(max, oldValue * std::cbrt(maxPart.volume / volume));
+		min = std::max(min, oldValue * std::max(minPart.scale.x / scale.x, std::max(minPart.scale.y / scale.y, minPart.scale.z / scale.z)));
+		max = std::min(max, oldValue * std::min(maxPart.scale.x / scale.x, std::min(maxPart.scale.y / scale.y, maxPart.scale.z / scale.z)));
 	}
 	else
 	{
-		valueAtMinVolume = oldValue * Model::getMinPart().volume / volume;
-		valueAtMaxVolume = oldValue * Model::getMaxPart().volume / volume;
+		// One radius and the volume change proportionally to the value
+		double radius, minRadius, maxRadius;
+		if (key == SCALE_X)
+		{
+			radius = scale.x;
+			minRadius = minPart.scale.x;
+			maxRadius = maxPart.scale.x;
+		} else if (key == SCALE_Y)
+		{
+			radius = scale.y;
+			minRadius = minPart.scale.y;
+			maxRadius = maxPart.scale.y;
+		} else
+		{
+			radius = scale.z;
+			minRadius = minPart.scale.z;
+			maxRadius = maxPart.scale.z;
+		}
+		min = std::max(min, oldValue * std::max(minPart.volume / volume, minRadius / radius));
+		max = std::min(max, oldValue * std::min(maxPart.volume / volume, maxRadius / radius));
 	}
-
-	double min = std::max(Node::minValues.at(key), valueAtMinVolume);
-	double max = std::min(Node::maxValues.at(key), valueAtMaxVolume);
+	if (min >= max)
+		return false;
 	double stdev = (max - min) * node->genotypeParams.paramMutationStrength;
 
-	node->params[key] = GenoOperators::mutateCreep('f', node->getParam(key), min, max, stdev, true);
+	int mark = geno.beginEdits();
+	geno.setParam(node, key, mutateCreep('f', node->getParam(key), min, max, stdev, true));
 
 	if (!ensureCircleSection || node->isPartScaleValid())
-		return true;
-	else
 	{
-		node->params[key] = oldValue;
-		return false;
+		geno.commitEdits();
+		return true;
 	}
+	geno.rollbackEdits(mark);
+	return false;
 }
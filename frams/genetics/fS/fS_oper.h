@@ -5,6 +5,10 @@
 #ifndef _FS_OPER_H_
 #define _FS_OPER_H_
 
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <condition_variable>
 #include "fS_general.h"
 #include "../genooperators.h"
 
@@ -31,7 +35,123 @@
 
 const int PARENT_COUNT = 2;
 
+/// The index of crossover in GenoOper_fS::stats, which follows the mutation types
+#define FS_STATS_CROSSOVER FS_OPCOUNT
 
+/**
+ * Counters of the work done by one genetic operator
+ */
+struct fS_OperatorStats
+{
+	long attempts = 0;	/// The number of times the operator was applied
+	long successes = 0;	/// The number of times it succeeded
+	long failures = 0;	/// The number of times it failed or raised an error
+	long retries = 0;	/// Attempts that followed a failed attempt in the same mutate() call
+	long stateCalculations = 0;	/// The number of fS_Genotype::getState() calls
+	long distanceEvaluations = 0;	/// The number of distances between parts that were calculated
+	double nanoseconds = 0;	/// The total time spent in the operator
+};
+
+/**
+ * Measures a single application of an operator and adds the result to its statistics
+ */
+class fS_OperatorProbe
+{
+	long stateCalculations, distanceEvaluations;
+	std::chrono::steady_clock::time_point start;
+public:
+	/**
+	 * Start measuring
+	 * @param geno the genotype whose current counters are the baseline, or nullptr if the genotypes do not exist yet
+	 */
+	fS_OperatorProbe(const fS_Genotype *geno = nullptr);
+
+	/**
+	 * Stop measuring and add the results to the statistics
+	 * @param geno0, geno1 the genotypes that the operator worked on, or nullptr
+	 * @return the time of the measured application in nanoseconds
+	 */
+	double finish(fS_OperatorStats &stats, bool success, const fS_Genotype *geno0, const fS_Genotype *geno1 = nullptr);
+};
+
+/// The number of genotype size classes in the adaptive mode; class k holds genotypes of 2^k ... 2^(k+1)-1 parts
+#define FS_SIZE_CLASSES 6
+
+const double ADAPTIVE_MIN_FACTOR = 0.05;	/// The lower bound of the factor applied to prob[] in the adaptive mode
+const double ADAPTIVE_MAX_FACTOR = 20.0;	/// The upper bound of the factor applied to prob[] in the adaptive mode
+const int ADAPTIVE_WINDOW = 100;	/// The number of attempts after which the adaptive counters are halved
+
+/**
+ * Success rate and cost of one mutation type on genotypes of one size class, learned in the adaptive mode
+ * The counters start with one success in two attempts so that unknown mutation types get an average rate,
+ * and they are halved from time to time so that old results fade out as the population changes.
+ */
+struct fS_AdaptiveRecord
+{
+	double attempts = 2;
+	double successes = 1;
+	double nanoseconds = 0;	/// The total time of the measured attempts
+	double timedAttempts = 0;	/// The number of the measured attempts
+};
+
+/**
+ * The result of one mutation attempt in the adaptive mode, recorded in produceOffspring() and learned after the batch
+ */
+struct fS_AdaptiveObservation
+{
+	int sizeClass;
+	int method;
+	bool success;
+	double nanoseconds;
+};
+
+
+/**
+ * One operation in a batch of offspring, see GenoOper_fS::produceOffspring()
+ */
+struct fS_OffspringTask
+{
+	int parent0;	/// The index of the parent in the list of parents
+	int parent1;	/// The index of the second parent for crossover, or -1 for mutation
+};
+
+/**
+ * The result of one fS_OffspringTask
+ */
+struct fS_Offspring
+{
+	int result = GENOPER_OPFAIL;	/// GENOPER_OK or GENOPER_OPFAIL
+	int method = -1;	/// The mutation type, or FS_STATS_CROSSOVER for crossover
+	string genotypes[PARENT_COUNT];	/// The offspring (only the first one for mutation); the parents if the operator failed
+	float chg[PARENT_COUNT] = {0, 0};	/// The amount of change of each offspring
+	bool neutral = false;	/// True if the mutation provably did not change the phenotype, so the fitness of the parent applies
+};
+
+/**
+ * Worker threads that are started once and then run the jobs of many GenoOper_fS::produceOffspring() calls
+ */
+class fS_ThreadPool
+{
+	vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable jobReady, jobDone;
+	const std::function<void(int)> *job = nullptr;	/// The current job, called with the index of the worker
+	int workerCount = 0;	/// The number of workers that take part in the current job, including the calling thread
+	int jobNumber = 0;	/// Incremented for every job, so that the threads notice new work
+	int busyThreads = 0;	/// The threads that have not finished the current job yet
+	bool stopping = false;
+
+	void work(int worker);
+
+public:
+	~fS_ThreadPool();
+
+	/**
+	 * Call job(i) for every i = 0 ... workerCount-1, each in a different thread, and wait until all the calls return
+	 * The calling thread is the worker 0. More threads are started when needed, and they are kept for the next jobs.
+	 */
+	void run(int workerCount, const std::function<void(int)> &job);
+};
 
 class GenoOper_fS : public GenoOperators
 {
@@ -42,33 +162,187 @@ public:
 	paInt useElli, useCub,  useCyl;
 	paInt strongAddPart;
 
+	fS_OperatorStats stats[FS_OPCOUNT + 1];	/// Statistics of the mutation types, followed by crossover
+	paInt mutationFailures;	/// The number of mutate() calls that returned GENOPER_OPFAIL
+
+	RandomGenerator *randomGenerator;	/// The generator set by setRandomGenerator(), or nullptr for the global one
+
+	paInt adaptiveProbabilities;	/// Scale prob[] by the success rate and cost of each mutation type
+	fS_AdaptiveRecord adaptive[FS_SIZE_CLASSES][FS_OPCOUNT];
+	vector<fS_AdaptiveObservation> *adaptiveObservations;	/// If not null, mutate() records the results here instead of learning from them
+
+	std::unique_ptr<fS_ThreadPool> threadPool;	/// The threads of produceOffspring(), started by its first call
+
+	/**
+	 * The operators change only the genotypes they are given and the state of this object, so mutate() and crossOver()
+	 * may run in many threads at once as long as each thread uses its own GenoOper_fS with its own random generator.
+	 */
 	GenoOper_fS();
 
+	/**
+	 * Set the random generator that the operators draw from
+	 * All the draws of the operators, including creep, neuron classes, connection weights and neuron properties,
+	 * come from this generator, so the results depend only on its seed.
+	 * @param generator the generator, owned by the caller, or nullptr to use the global one
+	 */
+	void setRandomGenerator(RandomGenerator *generator);
+
+	/// The random generator that the operators draw from
+	RandomGenerator &getRandomGenerator();
+
+	/**
+	 * Draw an index with the probabilities proportional to the given values, like GenoOperators::roulette(),
+	 * but from the random generator of this object
+	 * @return the drawn index, or -1 if all the values are zero
+	 */
+	int roulette(const double *probtab, const int count);
+
+	/**
+	 * The helpers below behave exactly like the GenoOperators helpers of the same names.
+	 * Without a generator set by setRandomGenerator() they call those helpers, which draw from the global generator,
+	 * and otherwise they do the same draws from the generator of this object.
+	 */
+	double mutateCreep(char type, double current, double min, double max, double stddev, bool limit_precision_3digits);
+
+	/// mutateCreep() with the standard deviation of one tenth of the range
+	double mutateCreep(char type, double current, double min, double max, bool limit_precision_3digits);
+
+	/// A change by mutateCreep() that is not bounded by a range
+	double mutateCreepNoLimit(char type, double current, double stddev, bool limit_precision_3digits);
+
+	/// Draw one of the active neuron classes that can be used in models made of solid parts, or nullptr if there is none
+	NeuroClass *getRandomNeuroClass();
+
+	/// Draw a new weight of a neuron connection around the current one
+	double getMutatedNeuronConnectionWeight(double current);
+
+	/**
+	 * Change a random property of the neuron, either one of its extra properties or one of the properties of its class
+	 * @return true if the value of the property was changed
+	 */
+	bool mutateRandomNeuroClassProperty(fS_Neuron *neuron);
+
+	/**
+	 * Change a numeric property by creep within its range
+	 * @return true if the value of the property was changed, false if it is read-only, not numeric or it stayed the same
+	 */
+	bool mutateProperty(ParamInterface &properties, int index);
+
+	/// Set all the operator statistics to zero
+	void resetStats();
+
+	/// Forget what the adaptive mode has learned
+	void resetAdaptive();
+
+	/**
+	 * Get the size class of a genotype for the adaptive mode
+	 * @param partCount the number of parts in genotype
+	 * @return index in the range 0 ... FS_SIZE_CLASSES-1
+	 */
+	static int getSizeClass(int partCount);
+
+	/**
+	 * Calculate the mutation probabilities used by the adaptive mode
+	 * Each prob[] value is multiplied by the expected number of successes per unit of time of its mutation type,
+	 * relative to the average one. The factor is bounded, so no mutation type with non-zero prob[] is ever excluded.
+	 * @param sizeClass the size class of the mutated genotype
+	 * @param result the probabilities, an array of FS_OPCOUNT elements
+	 */
+	void getAdaptiveProbabilities(int sizeClass, double *result);
+
+	/**
+	 * Record the result of a mutation in the adaptive mode
+	 */
+	void updateAdaptive(int sizeClass, int method, bool success, double nanoseconds);
+
+#define STATRICKCLASS GenoOper_fS
+	PARAMGETDEF(stats);
+	PARAMPROCDEF(p_resetstats);
+#undef STATRICKCLASS
+
 	int crossOver(char *&g1, char *&g2, float &chg1, float &chg2);
 
 	int checkValidity(const char *geno, const char *genoname);
 
 	int mutate(char *&geno, float &chg, int &method);
 
+	/**
+	 * Mutate the genotype and check whether the phenotype stayed the same
+	 * Some mutations do not change the model, e.g., adding a param with its default value, or changing a modifier
+	 * when the modifier multiplier is 1. Then the fitness of the parent can be reused without converting
+	 * and evaluating the offspring. The check parses the parent again, but only when the mutation did not change
+	 * the tree or the neurons, as such mutations are never reported as neutral.
+	 * @param neutral set to true if the offspring provably builds the same model as the parent
+	 * @return GENOPER_OK or GENOPER_OPFAIL, as mutate()
+	 */
+	int mutate(char *&geno, float &chg, int &method, bool &neutral);
+
+	/// The implementation of both variants of mutate(); the phenotype is compared only if neutral is not null
+	int mutate(char *&geno, float &chg, int &method, bool *neutral);
+
+	/**
+	 * Copy the mutation probabilities, the other settings and the learned adaptive state of another object
+	 */
+	void copySettings(const GenoOper_fS &source);
+
+	/**
+	 * Perform many mutations and crossovers in parallel
+	 * Every task draws from its own random generator seeded by getTaskSeed(). In the adaptive mode, all the tasks use
+	 * the state learned before the call, and the results of their mutations are learned after the batch, in the order
+	 * of tasks. So the offspring of one call do not depend on the number of threads. The learned state depends on
+	 * the measured time of mutations, though, so the offspring of the next calls are not reproducible in this mode.
+	 * The statistics of all the tasks are added to the statistics of this object.
+	 * The worker threads are kept for the next calls, as this is typically called between every two batches of evaluations.
+	 * @param parents the parent genotypes
+	 * @param plan the operations to perform
+	 * @param seed the seed of the whole batch
+	 * @param threadCount the number of worker threads, 0 for the number of hardware threads
+	 * @return the results, in the order of the plan
+	 */
+	vector<fS_Offspring> produceOffspring(const vector<string> &parents, const vector<fS_OffspringTask> &plan, unsigned int seed, int threadCount = 0);
+
+	/**
+	 * The seed of the random generator of a single task in produceOffspring()
+	 */
+	static unsigned int getTaskSeed(unsigned int seed, int task);
+
 	uint32_t style(const char *g, int pos);
 
 	const char* getSimplest();
 
+	/**
+	 * Perform the selected mutation on genotype
+	 * A failed mutation may leave partial changes; they are reverted by rolling back the edits of the genotype.
+	 * @param geno the mutated genotype
+	 * @param method the index of the mutation, one of FS_ADD_PART ... FS_MOD_NEURO_PARAMS
+	 * @param availablePartShapes part shapes that mutations may use
+	 * @return true if mutation succeeded, false otherwise
+	 */
+	bool performMutation(fS_Genotype &geno, int method, const vector<Part::Shape> &availablePartShapes);
+
+	/**
+	 * Find the subtree size that is the most similar to the given size
+	 * The similarity is measured by the quotient of the greater and the smaller size
+	 * @param nodesBySize Nodes grouped by the sizes of their subtrees, as returned by fS_Genotype::getNodesBySubtreeSize()
+	 * @param size The size to be matched
+	 * @param bucket Set to the nodes whose subtree size is the most similar
+	 * @return The quotient of the matched sizes (1.0 for equal sizes)
+	 */
+	static double findMostSimilarSize(const std::map<int, vector<Node *>> &nodesBySize, int size, const vector<Node *> *&bucket);
+
 	/**
 	 * Remove connections to the subtree that will be removed from genotype
 	 * @param geno An fS_Genotype
 	 * @param sub A subtree that will be removed from genotype
-	 * @param subStart An index of the first neuron in the removed genotype
 	 */
-	void rearrangeConnectionsBeforeCrossover(fS_Genotype *geno, Node *sub, int &subStart);
+	void rearrangeConnectionsBeforeCrossover(fS_Genotype *geno, Node *sub);
 
 	/**
-	 *
+	 * Give new identifiers to the neurons of a subtree that was added to genotype and remove their inputs
 	 * @param geno An fS_Genotype
 	 * @param sub A subtree that was added to genotype
-	 * @param subOldStart An index of the first neuron in the subtree when it was in old genotype
 	 */
-	void rearrangeConnectionsAfterCrossover(fS_Genotype *geno, Node *sub, int subOldStart);
+	void rearrangeConnectionsAfterCrossover(fS_Genotype *geno, Node *sub);
 
 
 	/**
@@ -116,11 +390,12 @@ public:
 	/**
 	 * Changes the value of specified parameter.
 	 * The state of the node must be previously calculated
+	 * @param geno - the genotype that the node belongs to
 	 * @param node - the node on which parameter is modified
 	 * @param key - the key of parameter
 	 * @return
 	 */
-	bool mutateParamValue(Node *node, string key);
+	bool mutateParamValue(fS_Genotype &geno, Node *node, string key);
 
 	/**
 	 * Performs change modifier mutation on genotype
@@ -142,13 +417,14 @@ public:
 
 	/**
 	 * Change the value of the scale parameter by given multiplier
-	 * Do not change the value if any of the scale restrictions is not satisfied
+	 * The new value is drawn from the interval in which the volume and the radii of the part stay within limits.
+	 * Do not change the value if the interval is empty or a circle section requires the radius to stay as it is
 	 * @param paramKey
 	 * @param multiplier
 	 * @param ensureCircleSection
 	 * @return True if the parameter value was change, false otherwise
 	 */
-	bool mutateScaleParam(Node *node, string key, bool ensureCircleSection);
+	bool mutateScaleParam(fS_Genotype &geno, Node *node, string key, bool ensureCircleSection);
 };
 
 #endif
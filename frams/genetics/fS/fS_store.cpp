@@ -0,0 +1,136 @@
+// This file is a part of Framsticks SDK.  http://www.framsticks.com/
+// Copyright (C) 2019-2020  Maciej Komosinski and Szymon Ulatowski.
+// See LICENSE.txt for details.
+
+#include "fS_store.h"
+
+fS_SharedNodePtr fS_SubtreeStore::intern(fS_SharedNode &&node)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto range = nodes.equal_range(node.hash);
+	for (auto it = range.first; it != range.second;)
+	{
+		fS_SharedNodePtr existing = it->second.lock();
+		if (!existing)
+		{
+			it = nodes.erase(it);
+			continue;
+		}
+		// Equal hashes are not enough; the children are already shared, so they are compared by pointers
+		if (existing->prefix == node.prefix && existing->params == node.params
+			&& existing->neuronDetails == node.neuronDetails && existing->children == node.children)
+			return existing;
+		++it;
+	}
+
+	// Forget the nodes that are not used any more, once the table has grown enough since the last time
+	if (nodes.size() >= sweepThreshold)
+	{
+		for (auto it = nodes.begin(); it != nodes.end();)
+			it = it->second.expired() ? nodes.erase(it) : std::next(it);
+		sweepThreshold = std::max(MIN_SWEEP_THRESHOLD, 2 * nodes.size());
+	}
+
+	fS_SharedNodePtr result = std::make_shared<const fS_SharedNode>(std::move(node));
+	nodes.insert({result->hash, result});
+	return result;
+}
+
+fS_SharedNodePtr fS_SubtreeStore::share(Node *node)
+{
+	fS_SharedNode shared;
+	shared.hash = node->getHash();
+	shared.prefix = node->genoPrefixCache;
+	shared.params = node->genoParamsCache;
+	shared.nodeCount = 1;
+	shared.neuronCount = int(node->neurons.size());
+	for (int i = 0; i < int(node->neurons.size()); i++)
+		shared.neuronDetails.push_back(node->neurons[i]->getDetails());
+	for (int i = 0; i < int(node->children.size()); i++)
+	{
+		fS_SharedNodePtr child = share(node->children[i]);
+		shared.nodeCount += child->nodeCount;
+		shared.neuronCount += child->neuronCount;
+		shared.children.push_back(child);
+	}
+	return intern(std::move(shared));
+}
+
+fS_StoredGenotype fS_SubtreeStore::store(fS_Genotype &genotype)
+{
+	// Writing the genotype fills the caches of the prefixes and params of all the nodes
+	SString text = genotype.getGeno();
+
+	fS_StoredGenotype result;
+	const char *separator = strchr(text.c_str(), MODE_SEPARATOR);
+	result.header.assign(text.c_str(), separator + 1 - text.c_str());
+	result.root = share(genotype.startNode);
+
+	vector<fS_Neuron *> allNeurons = genotype.getAllNeurons();
+	vector<int> neuronPositions = genotype.getNeuronPositions();
+	for (int i = 0; i < int(allNeurons.size()); i++)
+	{
+		result.firstInput.push_back(int(result.inputs.size()));
+		for (auto it = allNeurons[i]->inputs.begin(); it != allNeurons[i]->inputs.end(); ++it)
+			result.inputs.push_back({getNeuronPosition(neuronPositions, it->first), it->second});
+		std::sort(result.inputs.begin() + result.firstInput.back(), result.inputs.end());
+	}
+	result.firstInput.push_back(int(result.inputs.size()));
+	return result;
+}
+
+fS_StoredGenotype fS_SubtreeStore::store(const string &genotype)
+{
+	fS_Genotype parsed(genotype);
+	return store(parsed);
+}
+
+void fS_SubtreeStore::write(fS_GenoWriter &writer, const fS_StoredGenotype &genotype, const fS_SharedNode *node, int &neuronPosition)
+{
+	writer.write(node->prefix);
+	if (!node->neuronDetails.empty())
+	{
+		writer.write(NEURON_START);
+		for (int i = 0; i < int(node->neuronDetails.size()); i++)
+		{
+			if (i != 0)
+				writer.write(NEURON_SEPARATOR);
+			int first = genotype.firstInput[neuronPosition], end = genotype.firstInput[neuronPosition + 1];
+			writer.writeNeuron(node->neuronDetails[i], genotype.inputs.data() + first, end - first);
+			neuronPosition++;
+		}
+		writer.write(NEURON_END);
+	}
+	writer.write(node->params);
+
+	if (node->children.size() == 1)
+		write(writer, genotype, node->children[0].get(), neuronPosition);
+	else if (node->children.size() > 1)
+	{
+		writer.write(BRANCH_START);
+		for (int i = 0; i < int(node->children.size()); i++)
+		{
+			if (i != 0)
+				writer.write(BRANCH_SEPARATOR);
+			write(writer, genotype, node->children[i].get(), neuronPosition);
+		}
+		writer.write(BRANCH_END);
+	}
+}
+
+SString fS_SubtreeStore::getGeno(const fS_StoredGenotype &genotype)
+{
+	fS_GenoWriter writer;
+	writer.write(genotype.header);
+	int neuronPosition = 0;
+	write(writer, genotype, genotype.root.get(), neuronPosition);
+	return SString(writer.c_str(), writer.length());
+}
+
+int fS_SubtreeStore::getSharedNodeCount()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto it = nodes.begin(); it != nodes.end();)
+		it = it->second.expired() ? nodes.erase(it) : std::next(it);
+	return int(nodes.size());
+}
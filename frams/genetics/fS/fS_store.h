@@ -0,0 +1,102 @@
+// This file is a part of Framsticks SDK.  http://www.framsticks.com/
+// Copyright (C) 2019-2020  Maciej Komosinski and Szymon Ulatowski.
+// See LICENSE.txt for details.
+
+#ifndef _FS_STORE_H_
+#define _FS_STORE_H_
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "fS_general.h"
+
+/**
+ * An immutable node of the trees shared by the genotypes of fS_SubtreeStore
+ * Neuron inputs are not stored in nodes, because they may lead outside the subtree; see fS_StoredGenotype.
+ */
+struct fS_SharedNode
+{
+	uint64_t hash;	/// The structural hash of the subtree, equal to the one of Node::getHash()
+	string prefix;	/// The joint, modifiers and part type, as written in fS
+	vector<SString> neuronDetails;	/// The details of the neurons of the node
+	string params;	/// The params, as written in fS
+	vector<std::shared_ptr<const fS_SharedNode>> children;
+	int nodeCount;	/// The number of nodes in the subtree
+	int neuronCount;	/// The number of neurons in the subtree
+};
+
+typedef std::shared_ptr<const fS_SharedNode> fS_SharedNodePtr;
+
+/**
+ * A genotype whose tree is kept in fS_SubtreeStore
+ * Copying is cheap, as the tree is shared, not copied.
+ */
+struct fS_StoredGenotype
+{
+	string header;	/// The genotype params, as written in fS before the tree
+	fS_SharedNodePtr root;
+	/// The inputs of the neuron at position i are inputs[firstInput[i]] ... inputs[firstInput[i + 1] - 1]
+	vector<int> firstInput;
+	/// The positions of the input neurons and the weights of connections, sorted by positions for every neuron
+	vector<std::pair<int, double>> inputs;
+
+	int getNodeCount() const { return root ? root->nodeCount : 0; }
+};
+
+/**
+ * Keeps the trees of many fS genotypes, so that each distinct subtree is stored once
+ * Subtrees are found by their structural hashes (hash consing) and shared by reference counting.
+ * A genotype that was mutated or crossed over shares all its unchanged subtrees with its parents;
+ * only the nodes on the paths from the root to the changes are new.
+ * Only the storage is shared: store() writes and looks up the whole tree of the genotype, and the operators still
+ * work on fS_Genotype parsed from the full text, so mutations and crossovers do not become cheaper.
+ * A subtree is freed when no stored genotype uses it. All the methods may be called from many threads.
+ * fS_Genotype::precision must not change while the store is in use.
+ */
+class fS_SubtreeStore
+{
+	std::mutex mutex;
+	std::unordered_multimap<uint64_t, std::weak_ptr<const fS_SharedNode>> nodes;	/// All the shared nodes, by their hashes
+	static constexpr size_t MIN_SWEEP_THRESHOLD = 1024;
+	size_t sweepThreshold = MIN_SWEEP_THRESHOLD;	/// The size of the table at which the nodes that are not used any more are removed
+
+	/**
+	 * Find the shared node equal to the given one, or add it to the store
+	 * The children of the node must be already shared.
+	 */
+	fS_SharedNodePtr intern(fS_SharedNode &&node);
+
+	/// Share the subtree that starts in the node; the caches of the genotype representation must be valid
+	fS_SharedNodePtr share(Node *node);
+
+	void write(fS_GenoWriter &writer, const fS_StoredGenotype &genotype, const fS_SharedNode *node, int &neuronPosition);
+
+public:
+	/**
+	 * Store the genotype, sharing its subtrees with the genotypes stored before
+	 * @param genotype the genotype; its caches are updated, but it does not change
+	 * @return the stored genotype, which remains valid when the given one is destroyed
+	 */
+	fS_StoredGenotype store(fS_Genotype &genotype);
+
+	/**
+	 * Parse and store the genotype
+	 * @param genotype in fS format
+	 * @throws fS_Exception if the genotype is invalid
+	 */
+	fS_StoredGenotype store(const string &genotype);
+
+	/**
+	 * Get the genotype in fS format
+	 * @return the same text as fS_Genotype::getGeno() of the stored genotype
+	 */
+	SString getGeno(const fS_StoredGenotype &genotype);
+
+	/**
+	 * Get the number of distinct subtrees that are used by the stored genotypes
+	 * Also forgets the subtrees that are not used any more.
+	 */
+	int getSharedNodeCount();
+};
+
+#endif
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Runs the same deterministic fS evolution in evol_test with 1 and with 4 evaluation threads, in batches of 8.
+# The outputs must be the same, and the population must change during the run.
+# The fitness is the genotype length, so the check does not depend on the build of the simulator.
+# The first argument is the path of evol_test (../evol_test by default, like in go.sh).
+
+EVOL_TEST=${1:-../evol_test}
+OUT1=$(mktemp)
+OUT4=$(mktemp)
+trap 'rm -f "$OUT1" "$OUT4"' EXIT
+
+"$EVOL_TEST" 1 10 200 0.6 0.4 S L - 1 8 > "$OUT1" 2>/dev/null || { echo "evol_test with 1 thread failed"; exit 1; }
+"$EVOL_TEST" 1 10 200 0.6 0.4 S L - 4 8 > "$OUT4" 2>/dev/null || { echo "evol_test with 4 threads failed"; exit 1; }
+
+if ! cmp -s "$OUT1" "$OUT4"
+then
+	echo "evol_test: the outputs with 1 and 4 threads differ"
+	diff "$OUT1" "$OUT4" | head -20
+	exit 1
+fi
+
+# The statistics of the first and the last population, without the number of evaluations
+FIRST=$(grep '^Evaluation' "$OUT1" | head -n 1 | cut -f 2-)
+LAST=$(grep '^Evaluation' "$OUT1" | tail -n 1 | cut -f 2-)
+if [ -z "$FIRST" ] || [ "$FIRST" = "$LAST" ]
+then
+	echo "evol_test: the population did not change, so the runs prove nothing"
+	exit 1
+fi
+
+echo "evol_test: the same output with 1 and 4 threads"
@@ -6,3 +6,6 @@ for testset in SDK-tests.txt geometry-tests.txt similarity-tests.txt fS_tests.tx
 do
 	python3 ../../tester/tester.py "$@" -e '(.+)=../\1' -f $testset 
 done
+
+# evol_test is compared with itself, because its output depends on the build
+./evol_test_threads.sh ../evol_test